@@ -0,0 +1,87 @@
+#pragma once
+#ifndef __I2C_BUS_H
+#define __I2C_BUS_H
+
+#include "stm32f429i_discovery.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#define I2C_BUS_HIGH_QUEUE_LEN 24
+#define I2C_BUS_LOW_QUEUE_LEN 8
+#define I2C_BUS_DMA_TIMEOUT_MS 50
+#define I2C_BUS_RETRIES 3
+#define I2C_BUS_BACKOFF_MS 2 /* doubled on every retry */
+/* one DMA transaction with every attempt timing out, about 1 ms per bus clear */
+#define I2C_BUS_DMA_WORST_MS (I2C_BUS_DMA_TIMEOUT_MS * (I2C_BUS_RETRIES + 1) + I2C_BUS_BACKOFF_MS * ((1 << I2C_BUS_RETRIES) - 1) + I2C_BUS_RETRIES)
+
+typedef enum i2c_bus_priority {
+	I2C_BUS_PRIORITY_HIGH = 0, ///< sensor traffic, always served before any queued low-priority transaction
+	I2C_BUS_PRIORITY_LOW,      ///< touch controller, IO expander, settings storage
+} i2c_bus_priority_t;
+
+typedef enum i2c_bus_op {
+	I2C_BUS_READ = 0,   ///< 8-bit register address, bytes
+	I2C_BUS_WRITE,
+	I2C_BUS_READ16,     ///< 16-bit register address, 16-bit words in host order
+	I2C_BUS_WRITE16,
+	I2C_BUS_READ16_DMA, ///< 16-bit register address, raw big-endian words by DMA
+} i2c_bus_op_t;
+
+/** Completion callback, runs in the bus task (or the caller before the scheduler starts) */
+typedef void (*i2c_bus_callback_t)(void* context, bool ok);
+
+typedef struct {
+	i2c_bus_op_t op;
+	uint8_t addr;
+	uint16_t reg;
+	void* data;      ///< must stay valid until the callback
+	uint16_t length; ///< bytes
+	i2c_bus_callback_t callback;
+	void* context;
+} i2c_bus_xfer_t;
+
+/** Fault counters, recovery times include the failed attempt that raised the fault */
+typedef struct {
+	uint32_t faults;          ///< transactions that failed at least once
+	uint32_t retries;
+	uint32_t busClears;
+	uint32_t stuckBus;        ///< bus clears that did not release SDA
+	uint32_t recovered;
+	uint32_t failed;          ///< transactions still failing after I2C_BUS_RETRIES
+	uint32_t lastRecoveryMs;
+	uint32_t maxRecoveryMs;
+	uint32_t totalRecoveryMs;
+} i2c_bus_telemetry_t;
+
+class I2CBus {
+public:
+	I2CBus();
+	~I2CBus();
+	void init();
+	void run();
+	bool submit(const i2c_bus_xfer_t& xfer, i2c_bus_priority_t priority);
+	bool transfer(i2c_bus_op_t op, uint8_t addr, uint16_t reg, void* data, uint16_t length, i2c_bus_priority_t priority);
+	uint16_t readData16(uint8_t addr, uint16_t reg, i2c_bus_priority_t priority);
+	bool writeData16(uint8_t addr, uint16_t reg, uint16_t value, i2c_bus_priority_t priority);
+	void transferCompleteFromISR(bool error, BaseType_t* higherPriorityTaskWoken);
+	uint32_t getTransfers(i2c_bus_priority_t priority);
+	const i2c_bus_telemetry_t& getTelemetry();
+protected:
+	bool execute(const i2c_bus_xfer_t& xfer);
+	bool executeOnce(const i2c_bus_xfer_t& xfer);
+	void backoff(uint32_t ms);
+	bool isOwnerRunning();
+private:
+	QueueHandle_t queues[2];
+	SemaphoreHandle_t pending;
+	volatile TaskHandle_t ownerTask;
+	volatile TaskHandle_t dmaTask;
+	volatile bool dmaDone;
+	volatile bool dmaError;
+	uint32_t transfers[2];
+	i2c_bus_telemetry_t telemetry;
+};
+
+#endif /* __I2C_BUS_H */
@@ -21,9 +21,29 @@ extern "C" {
 #define FRAMEBUFFER_SIZE  320 * 240 * 2
 #define FRAMEBUFFER2_ADDR FRAMEBUFFER_ADDR + FRAMEBUFFER_SIZE
 #define FRAMEBUFFER2_SIZE  320 * 240 * 2
-#define CUSTOM_DATA_ADDR  FRAMEBUFFER2_ADDR + FRAMEBUFFER2_SIZE
+#define FRAMEBUFFER3_ADDR FRAMEBUFFER2_ADDR + FRAMEBUFFER2_SIZE /* second layer 0 buffer */
+#define FRAMEBUFFER3_SIZE  320 * 240 * 2
+#define CUSTOM_DATA_ADDR  FRAMEBUFFER3_ADDR + FRAMEBUFFER3_SIZE
 
 #define THERMAL_SCALE 7
+#define VIS_MODE_PREVIEW 3
+#define IR_TO_SOLVER TO_SOLVER_EXACT /* To kernel, error bounds on to_solver_mode_t */
+#define SPOT_PIXEL (12 * 32 + 16) /* center of the 32x24 map */
+
+#define RENDER_EVENT_FRAME 0x01 /* IR compute published a frame */
+#define RENDER_EVENT_UI 0x02 /* vis_mode changed */
+#define RENDER_EVENT_PALETTE 0x04 /* color scheme changed */
+#define RENDER_MIN_INTERVAL_MS 0 /* 0 renders every frame, otherwise caps the redraw rate */
+#define INFO_REFRESH_MS 400
+
+#define LTDC_FRAME_PERIOD_US 7653 /* 12 MHz pixel clock, 280 x 328 total */
+#define LTDC_RELOAD_TIMEOUT_MS 50
+#define THERMAL_LAYER_L8 0 /* 1: layer 0 holds palette indices, the color scheme is loaded into the LTDC CLUT */
+#if THERMAL_LAYER_L8
+#define LAYER0_CLEAR_COLOR 0xFFFFFFFF /* 0xFF indices, the black CLUT entry */
+#else
+#define LAYER0_CLEAR_COLOR 0xFF000000
+#endif
 
 extern void Error_Handler(const uint8_t source);
 extern DMA2D_HandleTypeDef dma2dHandle;
@@ -7,7 +7,7 @@
 #define MLX90640_DEVICEID2 0x2408
 #define MLX90640_DEVICEID3 0x2409
 
-#define SCALEALPHA 0.000001
+#define SCALEALPHA 0.000001f
 
 typedef enum mlx90640_mode {
   MLX90640_INTERLEAVED, ///< Read data from camera by interleaved lines
@@ -46,7 +46,7 @@ typedef struct {
   float cpKv;
   float cpKta;
   uint8_t resolutionEE;
-  uint8_t calibrationModeEE;
+  uint8_t calibrationModeEE; ///< mlx90640_mode_t the offsets were calibrated in
   float KsTa;
   float ksTo[5];
   int16_t ct[5];
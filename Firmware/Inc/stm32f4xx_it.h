@@ -46,6 +46,9 @@ void PendSV_Handler(void);
 void SysTick_Handler(void);
 void LTDC_IRQHandler(void);
 void DMA2D_IRQHandler(void);
+void I2C3_EV_IRQHandler(void);
+void I2C3_ER_IRQHandler(void);
+void DMA1_Stream2_IRQHandler(void);
 
 extern void hard_fault_handler(unsigned int * hardfault_args);
 
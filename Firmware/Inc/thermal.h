@@ -3,52 +3,276 @@
 #define __THERMAL_H
 
 #include "stm32f429i_discovery.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
 #include <mlx90640.h>
+#include <i2c_bus.h>
+#include <triple_buffer.h>
 
-#define THERM_COEFF 0.0625
-#define TEMP_COEFF 0.25
+#define THERM_COEFF 0.0625f
+#define TEMP_COEFF 0.25f
+
+#define FRAME_BURST_TIMEOUT_MS (2 * I2C_BUS_DMA_WORST_MS) ///< a burst behind another one, both retried to the end
+#define CONTROL_REVALIDATE_MS 1000
+#define FRAME_BURSTS_MAX 20
+#define FRAME_BURST_MERGE_GAP 2
+#define FRAME_BURST_OVERHEAD 4
+#define FRAME_WAKE_GUARD_MS 2
+#define FRAME_POLL_STEP_MS 1
+#define FRAME_PERIOD_GAIN 0.125f
+#define FRAME_PERIOD_SHRINK_MS 0.1f
+#define RAW_FRAME_POOL 3 ///< one being read, one being computed, one spare
+
+#define OFFSET_CACHE_TA_EPS 0.05f
+#define OFFSET_CACHE_VDD_EPS 0.001f
+
+#define TO_ROOT_TABLE_BITS 7
+
+#define TO_LUT_SIZE 1024
+#define TO_LUT_TO_MIN -45.0f
+#define TO_LUT_TO_MAX 320.0f
+#define TO_LUT_REBUILD_CHUNK 128
+#define TO_LUT_TA_EPS 0.05f
+#define TO_LUT_SHIFT_MAX 0.08f ///< Ta distance up to which a shifted table stays within the LUT bound
+
+#define BAD_PIXELS_MAX 40
+
+#define CALIB_CACHE_ADDR 0x081E0000 ///< flash sector 23, the last 128 KB of the F429ZI
+#define CALIB_CACHE_SECTOR FLASH_SECTOR_23
+#define CALIB_CACHE_MAGIC 0x4D4C5843
+#define CALIB_CACHE_VERSION 2 ///< bump with any change to how convertMlxEEToParams fills paramsMLX90640_t
+
+#define TEMP_HIST_BINS 32
+#define TEMP_HIST_MIN -40.0f
+#define TEMP_HIST_BIN_WIDTH 10.0f
+
+#define IR_CLUT_LEVELS 255 ///< L8 ramp entries, the last CLUT entry is the black background
+
+/** Fourth-root kernel used by the To solver, max To error vs the double Melexis solve over -40..300 C (Test/test_solver) */
+typedef enum to_solver_mode {
+	TO_SOLVER_EXACT, ///< sqrtf(sqrtf(x)) on vsqrt.f32, < 0.0001 K
+	TO_SOLVER_FAST,  ///< bit-trick x^-1/4 seed + 2 Newton steps, < 0.025 K
+	TO_SOLVER_TABLE, ///< 4 << TO_ROOT_TABLE_BITS entry seed table + 1 Newton step, < 0.005 K
+	TO_SOLVER_LUT,   ///< piecewise-linear To(s) table per Ta/emissivity, < 0.01 K, exact while no table is within TO_LUT_SHIFT_MAX
+} to_solver_mode_t;
+
+/** To as a function of s = irData / (emissivity * alphaCompensated), sampled uniformly in s */
+typedef struct {
+	float sMin;
+	float sScale; ///< entries per unit of s
+	float ta;
+	float taTr;
+	float emissivity;
+	float to[TO_LUT_SIZE];
+} to_lut_t;
+
+/** What readImage produces per subpage */
+typedef enum ir_process_mode {
+	IR_PROCESS_RADIOMETRIC, ///< full To solve for every pixel
+	IR_PROCESS_PREVIEW,     ///< alpha-normalized IR signal only, To solved on demand for single pixels
+} ir_process_mode_t;
+
+/** A temperature frame: two consecutive subpages, stamped with their read ticks */
+typedef struct {
+	uint32_t sequence;    ///< counts complete frames only, a resync never reuses a number
+	TickType_t firstTick; ///< first subpage of the pair
+	TickType_t lastTick;  ///< second subpage, the frame is complete from here on
+	uint8_t firstSubPage;
+} ir_frame_info_t;
+
+/** What the thermal layer buffers hold */
+typedef enum ir_pixel_format {
+	IR_PIXEL_RGB565, ///< colors, a palette change needs a re-render
+	IR_PIXEL_L8,     ///< palette indices into the layer CLUT, half the bytes per pixel
+} ir_pixel_format_t;
+
+/** One subpage as read from frame RAM, with the configuration it was read under */
+typedef struct {
+	uint16_t data[832]; ///< raw big-endian frame RAM
+	uint16_t control;   ///< 0x800D at read time
+	uint8_t subPage;
+	TickType_t readTick;
+	uint32_t readCycles;
+} raw_frame_t;
+
+/** One burst read of frame RAM, in words from 0x0400 */
+typedef struct {
+	uint16_t offset;
+	uint16_t words;
+} frame_burst_t;
+
+class IRSensor;
+
+/** Completion context of a queued burst, tagged with the read it belongs to */
+typedef struct {
+	IRSensor* sensor;
+	uint32_t generation;
+} frame_burst_context_t;
+
+/** Per-subpage constants shared by every pixel of the To kernel */
+typedef struct {
+	float taTr;
+	float ksTo1Corr;
+	float emissivity;
+	float gain;
+	float cpCorrection;
+	float alphaTaCorr;
+	float alphaCorrR[4];
+	const to_lut_t* lut;
+	float lutSMin; ///< table sMin shifted by the Ta/Tr drift since the table was built
+} to_frame_params_t;
+
+/** A complete frame as published to the display, never modified once published */
+typedef struct {
+	ir_frame_info_t info;  ///< sequence 0 until the first frame
+	bool preview;          ///< map holds the normalized IR signal instead of To
+	float map[24*32];
+	float rangeMin;        ///< colorization range of map
+	float rangeMax;
+	float minTemp;
+	float maxTemp;
+	uint16_t coldDotIndex;
+	uint16_t hotDotIndex;
+	to_frame_params_t params; ///< constants of the last subpage, for spot solves of a preview map
+	float vdd;             ///< supply and ambient measured with the last subpage
+	float ta;
+} thermal_frame_t;
+
+/** Defective pixel, replaced by the mean of its good 4-neighbours */
+typedef struct {
+	uint16_t pixel;
+	uint16_t neighbors[4];
+	float weights[4];
+} bad_pixel_patch_t;
+
+/** Temperature statistics gathered by the To kernel, per subpage and merged per frame */
+typedef struct {
+	float min;
+	float max;
+	float sum;
+	uint16_t minIndex;
+	uint16_t maxIndex;
+	uint16_t count;
+	uint16_t hist[TEMP_HIST_BINS]; ///< TEMP_HIST_BIN_WIDTH wide bins from TEMP_HIST_MIN, ends clamped
+} temp_stats_t;
+
+/** Parsed calibration persisted in flash, valid only for the sensor serial it was parsed from */
+typedef struct {
+	uint32_t magic;
+	uint32_t version; ///< CALIB_CACHE_VERSION, a parser change invalidates the cache
+	uint16_t serial[3];
+	uint16_t size; ///< sizeof(paramsMLX90640_t), a layout change invalidates the cache
+} calib_cache_header_t;
+
+typedef struct {
+	calib_cache_header_t header;
+	paramsMLX90640_t params;
+	uint32_t crc; ///< CRC-32 of header and params, programmed last
+} calib_cache_t;
 
 class IRSensor {
 public:
 	IRSensor();
 	~IRSensor();
-	bool init(DMA2D_HandleTypeDef* dma2dHandler, uint8_t layer, const uint32_t fb_addr, const uint16_t fbSizeX, const uint16_t fbSizeY, const uint8_t* colorScheme);
+	bool init(I2CBus* bus, DMA2D_HandleTypeDef* dma2dHandler, uint8_t layer, const uint32_t fb_addr, const uint16_t fbSizeX, const uint16_t fbSizeY, const uint8_t* colorScheme);
 	void setColorScheme(const uint8_t* colorScheme);
+	uint32_t getColorSchemeVersion();
+	void setPixelFormat(ir_pixel_format_t format);
+	ir_pixel_format_t getPixelFormat();
+	void buildClut(uint32_t* clut);
 	void setFbAddress(const uint32_t fb_addr);
 	void setFbSize(const uint16_t fbSizeX, const uint16_t fbSizeY);
 	uint16_t* readSerialNumber();
 	void readMlxEE();
 	void convertMlxEEToParams();
+	void expandMlxParams();
+	uint8_t getBadPixelCount();
+	bool isCalibrationCached();
+	bool storePendingCalibration();
+	uint32_t getInitTime();
 	mlx90640_refreshrate_t readRefreshRate();
 	void setRefreshRate(mlx90640_refreshrate_t rate);
 	mlx90640_resolution_t readADCResolution();
 	void setADCResolution(mlx90640_resolution_t resolution);
 	mlx90640_mode_t readMlxMode();
 	void setMlxMode(mlx90640_mode_t mode);
+	uint32_t getControlRestores();
+	uint32_t getDroppedFrames();
+	uint32_t getBurstStalls();
+	const ir_frame_info_t& getFrameInfo();
+	uint32_t getSubPageRepeats();
+	uint32_t getSubPageSkips();
+	uint32_t getResyncs();
 	bool isFrameReady();
+	bool waitFrameReady();
+	float getFramePeriod();
+	float getPollsPerFrame();
+	float getAvgLateness();
 	bool isImageReady();
-	void readImage(float emissivity);
+	void setOffsetCacheEpsilon(float taEpsilon, float vddEpsilon);
+	uint32_t getOffsetCacheRebuilds();
+	uint32_t getOffsetCacheHits();
+	bool readImage(float emissivity);
+	bool acquireFrame();
+	bool processFrame(float emissivity, TickType_t timeout);
+	uint32_t getReadImageCycles();
+	uint32_t getBytesPerFrame();
+	uint32_t getCalcCycles();
+	uint32_t getCalcCyclesMax();
+	void setToSolverMode(to_solver_mode_t mode);
+	to_solver_mode_t getToSolverMode();
 	void calculateTempMap(float emissivity, float tr);
-	void calculateImageMap();
-	void findMinAndMaxTemp();
+	void calculateImageMap(float emissivity, float tr);
+	void setProcessMode(ir_process_mode_t mode);
+	ir_process_mode_t getProcessMode();
+	float getPixelTemp(const thermal_frame_t* frame, uint16_t index);
 	uint16_t getSubPage();
-	float getVdd();
-	float getTa();
 	float* getTempMap();
 	float getMaxTemp();
 	float getMinTemp();
+	float getAvgTemp();
+	const uint16_t* getTempHistogram();
 	uint16_t getHotDotIndex();
 	uint16_t getColdDotIndex();
 	uint16_t temperatureToRGB565(float temperature, float minTemp, float maxTemp);
-	void visualizeImage(uint8_t scale, uint8_t method);
-	void drawGradient(uint16_t startX, uint16_t startY, uint16_t stopX, uint16_t stopY);
+	uint8_t temperatureToIndex(float temperature, float minTemp, float maxTemp);
+	const thermal_frame_t* getLatestFrame();
+	void visualizeImage(const thermal_frame_t* frame, uint8_t scale, uint8_t method);
+	void drawGradient(const thermal_frame_t* frame, uint16_t startX, uint16_t startY, uint16_t stopX, uint16_t stopY);
 	void Dma2dXferCpltCallback(DMA2D_HandleTypeDef *hdma2d);
 protected:
+	template <typename pixel_t> pixel_t pixelColor(float temperature, float minTemp, float maxTemp);
+	template <typename pixel_t> void visualizeImageAs(const thermal_frame_t* frame, uint8_t scale, uint8_t method);
+	template <typename pixel_t> void drawGradientAs(const thermal_frame_t* frame, uint16_t startX, uint16_t startY, uint16_t stopX, uint16_t stopY);
 	uint16_t rgb2color(uint8_t R, uint8_t G, uint8_t B);
 	uint8_t calculateRGB(uint8_t rgb1, uint8_t rgb2, float t1, float step, float t);
 	uint8_t IsPixelBad(uint16_t index);
 	uint8_t CheckAdjacentPixels(uint16_t pix1, uint16_t pix2);
+	void updateOffsetCache();
+	void buildSubPageTables();
+	void buildReadoutPlan();
+	static void frameBurstComplete(void* context, bool ok);
+	void writeControlRegister(uint16_t value);
+	void revalidateControlRegister();
+	bool trackSubPage(TickType_t readTick);
+	void publishFrame();
+	bool readSubPage(raw_frame_t* raw);
+	void processSubPage(const raw_frame_t* raw, float emissivity);
+	void buildBadPixelMap();
+	bool loadCalibrationCache();
+	bool storeCalibrationCache();
+	void correctBadPixels(float* map);
+	void mergeTempStats();
+	void buildFrameParams(float emissivity, float tr);
+	template<to_solver_mode_t SOLVER> float solvePixelTemp(const to_frame_params_t& frame, float irData, uint16_t pixelNumber);
+	float solveNormalizedTemp(const to_frame_params_t& frame, float s);
+	void updateToLut();
+	template<to_solver_mode_t SOLVER, mlx90640_mode_t MODE, bool CALIB_MATCH, uint8_t SUBPAGE> void calculateTempMapKernel(const to_frame_params_t& frame);
 private:
+	typedef void (IRSensor::*TempMapKernel)(const to_frame_params_t& frame);
+	static const TempMapKernel tempMapKernels[4][2][2][2];
+
 	DMA2D_HandleTypeDef* dma2dHandler;
 	volatile bool _isImageReady;
 	uint8_t layer;
@@ -56,19 +280,95 @@ private:
 	uint16_t fbSizeX;
 	uint16_t fbSizeY;
 	const uint8_t* colorScheme;
+	volatile uint32_t colorSchemeVersion; ///< bumped by setColorScheme, the display re-uploads the CLUT on a change
+	ir_pixel_format_t pixelFormat;
 	paramsMLX90640_t mlxParams;
 	uint16_t mlxEE[832];
-	uint16_t frameData[834];
+	bool calibrationCached;
+	bool calibrationStorePending; ///< parsed at init, written to flash by storePendingCalibration
+	uint32_t initTimeMs;
+	float pixKta[24*32];
+	float pixKv[24*32];
+	float pixAlpha[24*32];
+	float pixOffset[24*32];
+	float pixIlChessCorr[24*32];
+	uint16_t subPagePixels[2][2][24*32/2];
+	frame_burst_t readoutPlan[2][2][FRAME_BURSTS_MAX];
+	uint8_t readoutPlanSize[2][2];
+	uint32_t frameBytes;
+	uint32_t badPixelMap[24*32/32];
+	bad_pixel_patch_t badPixelPatches[BAD_PIXELS_MAX];
+	uint8_t badPixelCount;
+	to_solver_mode_t toSolverMode;
+	to_frame_params_t frameParams;
+	to_lut_t toLut[2];
+	uint8_t toLutActive;
+	bool toLutValid;
+	int16_t toLutBuildPos;
+	to_frame_params_t toLutFrame;
+	volatile ir_process_mode_t processMode;
+	ir_process_mode_t lastProcessMode;
+	ir_process_mode_t displayMode;
+	uint8_t processedSubPages;
+	bool subPageValid;       ///< lastSubPage/lastSubPageTick describe a processed subpage
+	uint8_t lastSubPage;
+	TickType_t lastSubPageTick;
+	bool pairPending;        ///< the last subpage waits for its partner
+	ir_frame_info_t frameInfo;
+	uint32_t subPageRepeats;
+	uint32_t subPageSkips;
+	uint32_t resyncs;
+	uint32_t readImageCycles;
+	uint32_t calcCycles;
+	uint32_t calcCyclesMax;
+	bool offsetCacheValid;
+	float offsetCacheTa;
+	float offsetCacheVdd;
+	float offsetCacheTaEps;
+	float offsetCacheVddEps;
+	uint32_t offsetCacheRebuilds;
+	uint32_t offsetCacheHits;
+	raw_frame_t rawFrames[RAW_FRAME_POOL];
+	QueueHandle_t freeFrames;  ///< pool buffers owned by the acquisition side
+	QueueHandle_t readyFrames; ///< read subpages waiting for compute, oldest first
+	const uint16_t* frameData; ///< subpage being processed
+	uint16_t frameControl;     ///< its 0x800D
+	uint16_t controlRegister; ///< shadow of 0x800D
+	bool controlRegisterStale;
+	TickType_t controlCheckTick;
+	uint32_t controlRestores;
+	uint32_t lastBusFaults; ///< bus fault count at the last control register check
+	uint32_t droppedFrames;
+	uint32_t burstStalls;
+	uint8_t subPage;
+	I2CBus* bus;
+	volatile TaskHandle_t readTask;
+	volatile uint32_t readGeneration;
+	frame_burst_context_t burstContexts[FRAME_BURSTS_MAX];
+	float framePeriodMs;
+	TickType_t lastReadyTick;
+	bool lastReadyValid;
+	bool subPageLeftOver; ///< acquireFrame did not take the last ready subpage, its flag is still set
+	uint32_t framePolls;
+	uint32_t frameWaits;
+	uint32_t framesLatenessMs;
+	volatile bool readError;
 	float vdd;
 	float ta;
 	float dots[24*32];
 	uint16_t colors[24*32];
+	float irImage[24*32];
 	uint16_t coldDotIndex;
 	uint16_t hotDotIndex;
 	float minTemp;
 	float maxTemp;
-	const float minTempCorr = -0.5;
-	const float maxTempCorr = 0.5;
+	temp_stats_t subPageStats[2];
+	temp_stats_t frameStats;
+	temp_stats_t subPageImageStats[2];
+	temp_stats_t imageStats;
+	TripleBuffer<thermal_frame_t> frames; ///< compute task publishes, the display task reads
+	const float minTempCorr = -0.5f;
+	const float maxTempCorr = 0.5f;
 
 	uint16_t mlxSerialNumber[3];
 };
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef __TRIPLE_BUFFER_H
+#define __TRIPLE_BUFFER_H
+
+#include <stdint.h>
+
+#define TRIPLE_BUFFER_INDEX 0x03
+#define TRIPLE_BUFFER_FRESH 0x04 ///< the shared slot holds a buffer the consumer has not taken yet
+
+/* Single producer, single consumer, neither side ever waits. The producer fills its back buffer and
+   swaps it with the shared slot, the consumer swaps its front buffer with the shared slot only when
+   that holds something newer. Each side owns its buffer exclusively between swaps, so a buffer is
+   never read and written at the same time and a reader always sees a complete publication. */
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer()
+	{
+		this->back = 0;
+		this->middle = 1;
+		this->front = 2;
+	}
+
+	/** Producer side: the buffer to fill, owned by the producer until publish() */
+	T* writeBuffer()
+	{
+		return &buffers[back];
+	}
+
+	/** Producer side: hands the filled buffer over, the previous shared one becomes the next back buffer */
+	void publish()
+	{
+		back = __atomic_exchange_n(&middle, (uint8_t)(back | TRIPLE_BUFFER_FRESH), __ATOMIC_ACQ_REL) & TRIPLE_BUFFER_INDEX;
+	}
+
+	/** Consumer side: the latest published buffer, valid until the next call */
+	const T* latest()
+	{
+		if (__atomic_load_n(&middle, __ATOMIC_ACQUIRE) & TRIPLE_BUFFER_FRESH)
+		{
+			front = __atomic_exchange_n(&middle, front, __ATOMIC_ACQ_REL) & TRIPLE_BUFFER_INDEX;
+		}
+		return &buffers[front];
+	}
+
+private:
+	T buffers[3];
+	uint8_t back;   ///< producer's
+	uint8_t middle; ///< shared, index and TRIPLE_BUFFER_FRESH
+	uint8_t front;  ///< consumer's
+};
+
+#endif /* __TRIPLE_BUFFER_H */
@@ -0,0 +1,277 @@
+#include <i2c_bus.h>
+#include <string.h>
+
+/* Caller side of a blocking transfer() */
+typedef struct {
+	TaskHandle_t task;
+	volatile bool ok;
+} i2c_bus_waiter_t;
+
+static void wakeWaiter(void* context, const bool ok)
+{
+	i2c_bus_waiter_t* waiter = (i2c_bus_waiter_t*)context;
+	waiter->ok = ok;
+	xTaskNotifyGive(waiter->task);
+}
+
+I2CBus::I2CBus()
+{
+	this->queues[I2C_BUS_PRIORITY_HIGH] = NULL;
+	this->queues[I2C_BUS_PRIORITY_LOW] = NULL;
+	this->pending = NULL;
+	this->ownerTask = NULL;
+	this->dmaTask = NULL;
+	this->dmaDone = false;
+	this->dmaError = false;
+	this->transfers[I2C_BUS_PRIORITY_HIGH] = 0;
+	this->transfers[I2C_BUS_PRIORITY_LOW] = 0;
+	memset(&this->telemetry, 0, sizeof(this->telemetry));
+}
+
+I2CBus::~I2CBus()
+{
+}
+
+void I2CBus::init()
+{
+	queues[I2C_BUS_PRIORITY_HIGH] = xQueueCreate(I2C_BUS_HIGH_QUEUE_LEN, sizeof(i2c_bus_xfer_t));
+	queues[I2C_BUS_PRIORITY_LOW] = xQueueCreate(I2C_BUS_LOW_QUEUE_LEN, sizeof(i2c_bus_xfer_t));
+	pending = xSemaphoreCreateCounting(I2C_BUS_HIGH_QUEUE_LEN + I2C_BUS_LOW_QUEUE_LEN, 0);
+}
+
+/* Bus owner loop: one transaction at a time, the high queue is always drained first,
+   so sensor traffic waits for at most the low-priority transaction already on the wire */
+void I2CBus::run()
+{
+	ownerTask = xTaskGetCurrentTaskHandle();
+	i2c_bus_xfer_t xfer;
+	for (;;)
+	{
+		xSemaphoreTake(pending, portMAX_DELAY);
+		i2c_bus_priority_t priority = I2C_BUS_PRIORITY_HIGH;
+		if (xQueueReceive(queues[I2C_BUS_PRIORITY_HIGH], &xfer, 0) != pdPASS)
+		{
+			priority = I2C_BUS_PRIORITY_LOW;
+			if (xQueueReceive(queues[I2C_BUS_PRIORITY_LOW], &xfer, 0) != pdPASS)
+			{
+				continue;
+			}
+		}
+		transfers[priority]++;
+		const bool ok = execute(xfer);
+		if (xfer.callback != NULL)
+		{
+			xfer.callback(xfer.context, ok);
+		}
+	}
+}
+
+/* Before the scheduler starts, and inside completion callbacks, the caller already owns the bus */
+bool I2CBus::isOwnerRunning()
+{
+	if (ownerTask == NULL || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+	{
+		return false;
+	}
+	return xTaskGetCurrentTaskHandle() != ownerTask;
+}
+
+/* Queue a transaction, the callback reports its completion. Fails only if the queue is full. */
+bool I2CBus::submit(const i2c_bus_xfer_t& xfer, const i2c_bus_priority_t priority)
+{
+	if (!isOwnerRunning())
+	{
+		transfers[priority]++;
+		const bool ok = execute(xfer);
+		if (xfer.callback != NULL)
+		{
+			xfer.callback(xfer.context, ok);
+		}
+		return true;
+	}
+	if (xQueueSendToBack(queues[priority], &xfer, 0) != pdPASS)
+	{
+		return false;
+	}
+	xSemaphoreGive(pending);
+	return true;
+}
+
+/* Blocking transaction through the queue, uses the calling task's notification */
+bool I2CBus::transfer(const i2c_bus_op_t op, const uint8_t addr, const uint16_t reg, void* data, const uint16_t length, const i2c_bus_priority_t priority)
+{
+	i2c_bus_xfer_t xfer;
+	xfer.op = op;
+	xfer.addr = addr;
+	xfer.reg = reg;
+	xfer.data = data;
+	xfer.length = length;
+	xfer.callback = NULL;
+	xfer.context = NULL;
+
+	if (!isOwnerRunning())
+	{
+		transfers[priority]++;
+		return execute(xfer);
+	}
+
+	i2c_bus_waiter_t waiter;
+	waiter.task = xTaskGetCurrentTaskHandle();
+	waiter.ok = false;
+	xfer.callback = wakeWaiter;
+	xfer.context = &waiter;
+	if (!submit(xfer, priority))
+	{
+		return false;
+	}
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	return waiter.ok;
+}
+
+uint16_t I2CBus::readData16(const uint8_t addr, const uint16_t reg, const i2c_bus_priority_t priority)
+{
+	uint16_t value = 0;
+	transfer(I2C_BUS_READ16, addr, reg, &value, sizeof(value), priority);
+	return value;
+}
+
+bool I2CBus::writeData16(const uint8_t addr, const uint16_t reg, uint16_t value, const i2c_bus_priority_t priority)
+{
+	return transfer(I2C_BUS_WRITE16, addr, reg, &value, sizeof(value), priority);
+}
+
+/* A failed transaction gets a bus clear and up to I2C_BUS_RETRIES retries with growing backoff */
+bool I2CBus::execute(const i2c_bus_xfer_t& xfer)
+{
+	const uint32_t start = HAL_GetTick();
+	if (executeOnce(xfer))
+	{
+		return true;
+	}
+
+	telemetry.faults++;
+	bool ok = false;
+	for (uint8_t attempt = 0; attempt < I2C_BUS_RETRIES && !ok; attempt++)
+	{
+		telemetry.busClears++;
+		if (I2Cx_BusClear() != 0)
+		{
+			telemetry.stuckBus++;
+		}
+		backoff(I2C_BUS_BACKOFF_MS << attempt);
+		telemetry.retries++;
+		ok = executeOnce(xfer);
+	}
+
+	const uint32_t elapsed = HAL_GetTick() - start;
+	telemetry.lastRecoveryMs = elapsed;
+	telemetry.totalRecoveryMs += elapsed;
+	if (elapsed > telemetry.maxRecoveryMs)
+	{
+		telemetry.maxRecoveryMs = elapsed;
+	}
+	if (ok)
+	{
+		telemetry.recovered++;
+	}
+	else
+	{
+		telemetry.failed++;
+	}
+	return ok;
+}
+
+void I2CBus::backoff(const uint32_t ms)
+{
+	if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+	{
+		vTaskDelay(pdMS_TO_TICKS(ms));
+	}
+	else
+	{
+		HAL_Delay(ms);
+	}
+}
+
+bool I2CBus::executeOnce(const i2c_bus_xfer_t& xfer)
+{
+	bool ok = true;
+	switch (xfer.op)
+	{
+	case I2C_BUS_READ:
+		ok = (I2Cx_ReadBuffer(xfer.addr, (uint8_t)xfer.reg, (uint8_t*)xfer.data, xfer.length) == 0);
+		break;
+	case I2C_BUS_WRITE:
+		ok = (I2Cx_WriteBuffer(xfer.addr, (uint8_t)xfer.reg, (uint8_t*)xfer.data, xfer.length) == 0);
+		break;
+	case I2C_BUS_READ16:
+		ok = (I2Cx_ReadBuffer16(xfer.addr, xfer.reg, (uint16_t*)xfer.data, xfer.length) == 0);
+		break;
+	case I2C_BUS_WRITE16:
+		/* word by word, I2Cx_WriteBuffer16 would swap the caller's buffer in place */
+		for (uint16_t i = 0; i < xfer.length / 2; i++)
+		{
+			if (I2Cx_WriteData16(xfer.addr, xfer.reg + i, ((const uint16_t*)xfer.data)[i]) != 0)
+			{
+				ok = false;
+				break;
+			}
+		}
+		break;
+	case I2C_BUS_READ16_DMA:
+		{
+			const bool scheduled = (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+			dmaDone = false;
+			dmaError = false;
+			dmaTask = scheduled ? xTaskGetCurrentTaskHandle() : NULL;
+			if (scheduled)
+			{
+				ulTaskNotifyTake(pdTRUE, 0);
+			}
+			if (I2Cx_ReadBuffer16DMA(xfer.addr, xfer.reg, (uint16_t*)xfer.data, xfer.length) != 0)
+			{
+				dmaTask = NULL;
+				ok = false;
+				break;
+			}
+			if (scheduled)
+			{
+				ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(I2C_BUS_DMA_TIMEOUT_MS));
+			}
+			else
+			{
+				const uint32_t start = HAL_GetTick();
+				while (!dmaDone && (HAL_GetTick() - start) < I2C_BUS_DMA_TIMEOUT_MS)
+				{
+				}
+			}
+			dmaTask = NULL;
+			/* a stalled DMA is aborted by the bus clear in execute() */
+			ok = (dmaDone && !dmaError);
+		}
+		break;
+	}
+	return ok;
+}
+
+/* Called from the I2C DMA completion/error interrupts */
+void I2CBus::transferCompleteFromISR(const bool error, BaseType_t* higherPriorityTaskWoken)
+{
+	dmaError = error;
+	dmaDone = true;
+	const TaskHandle_t task = this->dmaTask;
+	if (task != NULL)
+	{
+		vTaskNotifyGiveFromISR(task, higherPriorityTaskWoken);
+	}
+}
+
+uint32_t I2CBus::getTransfers(const i2c_bus_priority_t priority)
+{
+	return this->transfers[priority];
+}
+
+const i2c_bus_telemetry_t& I2CBus::getTelemetry()
+{
+	return this->telemetry;
+}
@@ -4,31 +4,45 @@
 #include "cpu_utils.h"
 #include <framebuffer.h>
 #include <thermal.h>
+#include <i2c_bus.h>
 
-osThreadId LEDThread1Handle, LEDThread2Handle, LTDCThreadHandle, IRSensorThreadHandle, ReadKeysTaskHandle, SwapBuffersTaskHandle; 
+osThreadId I2cBusThreadHandle, LEDThread1Handle, LEDThread2Handle, LTDCThreadHandle, IRAcquireThreadHandle, IRSensorThreadHandle, ReadKeysTaskHandle; 
 
 LTDC_HandleTypeDef LtdcHandle;
 DMA2D_HandleTypeDef dma2dHandle;
 Framebuffer fbMainLayer;
 Framebuffer fbInfoLayer;
+I2CBus i2cBus;
 IRSensor irSensor;
 
-volatile uint32_t ReloadFlag = 0;
+/* layer 0 is drawn into the back buffer and swapped in at vertical blanking */
+const uint32_t layer0Buffers[2] = { FRAMEBUFFER_ADDR, FRAMEBUFFER3_ADDR };
+uint8_t layer0Front = 0;
+SemaphoreHandle_t reloadSemaphore = NULL;
+volatile uint32_t reloadCycles = 0;
+volatile uint32_t presentLatencyUs = 0;
+volatile uint32_t presentLatencyMaxUs = 0;
+volatile uint32_t framesDropped = 0;
+/* color scheme as loaded into the layer 0 CLUT, L8 only */
+uint32_t thermalClut[256];
+uint32_t clutVersion = 0;
 volatile uint8_t vis_mode = 1;
 volatile bool isSensorReady = false;
-volatile bool isSensorReadDone = false;
 volatile bool isFrameReady = false;
 volatile TickType_t xExecutionTime = 0;
 volatile uint32_t inWait = 0;
 
 
 /* Private function prototypes -----------------------------------------------*/
+static void I2cBus_Thread(void const *argument);
 static void LED_Thread1(void const *argument);
 static void LED_Thread2(void const *argument);
 static void LTDC_Thread(void const *argument);
+static void IrAcquire_Thread(void const *argument);
 static void IrSensor_Thread(void const *argument);
 static void ReadKeys_Thread(void const *argument);
-static void SwapBuffers_Thread(void const *argument);
+
+static void loadThermalClut(bool inBlanking);
 
 static void SystemClock_Config();
 static void LCD_Config();
@@ -61,35 +75,46 @@ int main()
 
 	/* Init I2C3 */
 	I2Cx_Init();
+	i2cBus.init();
 
 	DMA2D_Config();
 
 	BSP_SDRAM_Init();
 	LCD_Config();
 
-	fbMainLayer.init(&dma2dHandle, 1, FRAMEBUFFER_ADDR, 320, 240, 0xffff, 0x0000);
+	fbMainLayer.init(&dma2dHandle, 1, FRAMEBUFFER3_ADDR, 320, 240, 0xffff, 0x0000);
 	fbMainLayer.setOrientation(LANDSCAPE);
-	fbMainLayer.clear(0xFF000000);
+	fbMainLayer.clear(LAYER0_CLEAR_COLOR);
+	fbMainLayer.setFbAddr(FRAMEBUFFER_ADDR);
+	fbMainLayer.clear(LAYER0_CLEAR_COLOR);
+	reloadSemaphore = xSemaphoreCreateBinary();
 
 	fbInfoLayer.init(&dma2dHandle, 1, FRAMEBUFFER2_ADDR, 320, 240, ARGB_COLOR_WHITE | 0x8000, ARGB_COLOR_BLACK);
 	fbInfoLayer.setOrientation(LANDSCAPE);
 	fbInfoLayer.clear(0x00000000);
 
-	isSensorReady = irSensor.init(&dma2dHandle, 1, FRAMEBUFFER_ADDR, 320, 240, ALTERNATE_COLOR_SCHEME);
+	isSensorReady = irSensor.init(&i2cBus, &dma2dHandle, 1, layer0Buffers[layer0Front ^ 1], 320, 240, ALTERNATE_COLOR_SCHEME);
+	irSensor.setToSolverMode(IR_TO_SOLVER);
+#if THERMAL_LAYER_L8
+	irSensor.setPixelFormat(IR_PIXEL_L8);
+	loadThermalClut(false);
+#endif
   
+	osThreadDef(I2C_BUS, I2cBus_Thread, osPriorityAboveNormal, 0, configMINIMAL_STACK_SIZE + 128);
 	osThreadDef(LED3, LED_Thread1, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
 	osThreadDef(LED4, LED_Thread2, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
 	osThreadDef(LDTC, LTDC_Thread, osPriorityNormal, 0, configMINIMAL_STACK_SIZE + 128);
+	osThreadDef(IR_ACQUIRE, IrAcquire_Thread, osPriorityAboveNormal, 0, configMINIMAL_STACK_SIZE + 128);
 	osThreadDef(IR_SENSOR, IrSensor_Thread, osPriorityNormal, 0, configMINIMAL_STACK_SIZE + 2048);
 	osThreadDef(READ_KEYS, ReadKeys_Thread, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
-	osThreadDef(SWAP_BUFFERS, SwapBuffers_Thread, osPriorityNormal, 0, configMINIMAL_STACK_SIZE);
   
+	I2cBusThreadHandle = osThreadCreate(osThread(I2C_BUS), NULL);
 	LEDThread1Handle = osThreadCreate(osThread(LED3), NULL);
 	LEDThread2Handle = osThreadCreate(osThread(LED4), NULL);
 	LTDCThreadHandle = osThreadCreate(osThread(LDTC), NULL);
+	IRAcquireThreadHandle = osThreadCreate(osThread(IR_ACQUIRE), NULL);
 	IRSensorThreadHandle = osThreadCreate(osThread(IR_SENSOR), NULL);
 	ReadKeysTaskHandle = osThreadCreate(osThread(READ_KEYS), NULL);
-	SwapBuffersTaskHandle = osThreadCreate(osThread(SWAP_BUFFERS), NULL);
   
 	/* Start scheduler */
 	osKernelStart();
@@ -111,6 +136,16 @@ static void showSP()
 	}
 }
 
+/**
+  * @brief  I2C3 bus owner thread, runs queued transactions by priority
+  * @param  argument not used
+  * @retval None
+  */
+static void I2cBus_Thread(void const *argument)
+{
+	i2cBus.run();
+}
+
 /**
   * @brief  Toggle LED3 and LED4 thread
   * @param  argument not used
@@ -149,38 +184,130 @@ static void LED_Thread2(void const *argument)
 	}
 }
 
-static void IrSensor_Thread(void const *argument)
+/**
+  * @brief  IR acquisition thread: waits for each subpage and reads it into the raw frame pool
+  * @param  argument not used
+  * @retval None
+  */
+static void IrAcquire_Thread(void const *argument)
 {
 	(void) argument;
 	for (;;)
 	{
 		if (isSensorReady) {
-			const TickType_t xTime1 = xTaskGetTickCount();
-			while(!irSensor.isFrameReady())
+			const ir_process_mode_t processMode = (vis_mode == VIS_MODE_PREVIEW) ? IR_PROCESS_PREVIEW : IR_PROCESS_RADIOMETRIC;
+			if (processMode != irSensor.getProcessMode())
 			{
-				inWait = inWait + 1;
-				osDelay(5);
+				irSensor.setRefreshRate((processMode == IR_PROCESS_PREVIEW) ? MLX90640_32_HZ : MLX90640_16_HZ);
+				irSensor.setProcessMode(processMode);
 			}
-			irSensor.readImage(0.95f); //first subpage
-			showSP();
-			while(!irSensor.isFrameReady())
+
+			while(!irSensor.waitFrameReady())
 			{
 				inWait = inWait + 1;
-				osDelay(5);
 			}
-			irSensor.readImage(0.95f);// second subpage
+			irSensor.acquireFrame();
+		}
+		else
+		{
+			osDelay(10);
+		}
+	}
+}
+
+/**
+  * @brief  IR compute thread: turns acquired subpages into the temperature map
+  * @param  argument not used
+  * @retval None
+  */
+static void IrSensor_Thread(void const *argument)
+{
+	(void) argument;
+	uint32_t frameSequence = 0;
+	for (;;)
+	{
+		if (isSensorReady) {
+			if (!irSensor.processFrame(0.95f, portMAX_DELAY))
+			{
+				continue;
+			}
 			showSP();
-			irSensor.findMinAndMaxTemp();
-			const TickType_t xTime2 = xTaskGetTickCount();
-			xExecutionTime = xTime2 - xTime1;
-			isSensorReadDone = true;
+			/* a frame is a matching pair of subpages, a lost or repeated one starts over */
+			const ir_frame_info_t& frameInfo = irSensor.getFrameInfo();
+			if (frameInfo.sequence != frameSequence)
+			{
+				frameSequence = frameInfo.sequence;
+				xExecutionTime = xTaskGetTickCount() - frameInfo.firstTick;
+				xTaskNotify(LTDCThreadHandle, RENDER_EVENT_FRAME, eSetBits);
+				/* after a cold boot, once the first frame is out */
+				irSensor.storePendingCalibration();
+			}
+		}
+		else
+		{
+			osDelay(10);
 		}
-		osDelay(10);
 	}
 }
 
 
 
+/**
+  * @brief  Shows the layer 0 back buffer: the address is latched at the next vertical blanking,
+  *         the old front buffer is not handed out for drawing before the reload event.
+  * @retval None
+  */
+static void presentLayer0()
+{
+	const uint8_t back = layer0Front ^ 1;
+	xSemaphoreTake(reloadSemaphore, 0);
+	const uint32_t requestCycles = DWT->CYCCNT;
+	HAL_LTDC_SetAddress_NoReload(&LtdcHandle, layer0Buffers[back], 0);
+	HAL_LTDC_Reload(&LtdcHandle, LTDC_RELOAD_VERTICAL_BLANKING);
+	if (xSemaphoreTake(reloadSemaphore, pdMS_TO_TICKS(LTDC_RELOAD_TIMEOUT_MS)) == pdTRUE)
+	{
+		presentLatencyUs = (reloadCycles - requestCycles) / (SystemCoreClock / 1000000);
+		/* later than one refresh: at least one vertical blanking went by without the new frame */
+		if (presentLatencyUs > LTDC_FRAME_PERIOD_US)
+		{
+			framesDropped += presentLatencyUs / LTDC_FRAME_PERIOD_US;
+		}
+	}
+	else
+	{
+		/* no reload event, latch now rather than draw into the buffer on screen */
+		HAL_LTDC_Reload(&LtdcHandle, LTDC_RELOAD_IMMEDIATE);
+		presentLatencyUs = LTDC_RELOAD_TIMEOUT_MS * 1000;
+		framesDropped++;
+	}
+	if (presentLatencyUs > presentLatencyMaxUs)
+	{
+		presentLatencyMaxUs = presentLatencyUs;
+	}
+	layer0Front = back;
+	irSensor.setFbAddress(layer0Buffers[layer0Front ^ 1]);
+}
+
+/**
+  * @brief  Loads the current color scheme into the layer 0 CLUT. The table is built first so only
+  *         the register writes wait for vertical blanking, the picture never shows a mixed palette.
+  * @param  inBlanking: wait for vertical blanking, false before the scheduler runs
+  * @retval None
+  */
+static void loadThermalClut(const bool inBlanking)
+{
+	clutVersion = irSensor.getColorSchemeVersion();
+	irSensor.buildClut(thermalClut);
+	if (inBlanking)
+	{
+		xSemaphoreTake(reloadSemaphore, 0);
+		HAL_LTDC_Reload(&LtdcHandle, LTDC_RELOAD_VERTICAL_BLANKING);
+		xSemaphoreTake(reloadSemaphore, pdMS_TO_TICKS(LTDC_RELOAD_TIMEOUT_MS));
+	}
+	HAL_LTDC_ConfigCLUT(&LtdcHandle, thermalClut, 256, 0);
+	HAL_LTDC_EnableCLUT(&LtdcHandle, 0);
+}
+
 static void LTDC_Thread(void const *argument)
 {
 	(void) argument;
@@ -198,36 +325,93 @@ static void LTDC_Thread(void const *argument)
 	uint16_t hotDotY = 0;
 
 	uint16_t cpuUsage = 0;
-	const uint8_t hpUpdDelay = 20;
-	uint8_t cntr = hpUpdDelay;
-	bool oneTimeActionDone = false;
+	bool gradientDrawn[2] = { false, false }; /* per layer 0 buffer */
+	uint32_t events = 0;
+	uint32_t renders = 0;
+	uint16_t renderRate = 0;
+	TickType_t lastRender = 0;
+	TickType_t lastInfo = xTaskGetTickCount();
 
 	for (;;)
 	{
 		if (isSensorReady)
 		{
-			// const TickType_t xTime1 = xTaskGetTickCount();
+			/* sleep until a new frame or UI change, the info layer still refreshes on its own period */
+			const TickType_t infoDue = lastInfo + pdMS_TO_TICKS(INFO_REFRESH_MS);
+			const int32_t untilInfo = (int32_t)(infoDue - xTaskGetTickCount());
+			uint32_t notified = 0;
+			xTaskNotifyWait(0, 0xFFFFFFFF, &notified, (untilInfo > 0) ? (TickType_t)untilInfo : 0);
+			events |= notified;
+
+			if (events != 0 && RENDER_MIN_INTERVAL_MS > 0)
+			{
+				/* events arriving meanwhile are coalesced into this render */
+				const int32_t untilRender = (int32_t)(lastRender + pdMS_TO_TICKS(RENDER_MIN_INTERVAL_MS) - xTaskGetTickCount());
+				if (untilRender > 0)
+				{
+					vTaskDelay((TickType_t)untilRender);
+					xTaskNotifyWait(0, 0xFFFFFFFF, &notified, 0);
+					events |= notified;
+				}
+			}
 
-			irSensor.visualizeImage(THERMAL_SCALE, vis_mode);
+			/* map, range and hot/cold dots all come from one published frame */
+			const thermal_frame_t* frame = irSensor.getLatestFrame();
+			if (frame->info.sequence == 0)
+			{
+				events = 0;
+				lastInfo = xTaskGetTickCount();
+				continue;
+			}
 
-			if (!oneTimeActionDone && isSensorReadDone)
+			if (irSensor.getColorSchemeVersion() != clutVersion)
 			{
-				irSensor.drawGradient(250, 50, 260, 225);	
-				oneTimeActionDone = true;
+#if THERMAL_LAYER_L8
+				/* the buffers hold indices, only the CLUT changes */
+				loadThermalClut(true);
+				events &= ~RENDER_EVENT_PALETTE;
+#else
+				/* colors are baked into the buffers, gradient included */
+				clutVersion = irSensor.getColorSchemeVersion();
+				gradientDrawn[0] = false;
+				gradientDrawn[1] = false;
+				events |= RENDER_EVENT_PALETTE;
+#endif
 			}
-			
-			if (cntr >= hpUpdDelay)
+
+			if (events != 0)
 			{
-				cntr = 0;
-				const uint16_t hotDotIdx = irSensor.getHotDotIndex();
+				irSensor.visualizeImage(frame, THERMAL_SCALE, (vis_mode == VIS_MODE_PREVIEW) ? 0 : vis_mode);
+				/* the gradient is static, drawn into each buffer once it is the back one,
+				   never into the one on screen */
+				if (!gradientDrawn[layer0Front ^ 1])
+				{
+					irSensor.drawGradient(frame, 250, 50, 260, 225);	
+					gradientDrawn[layer0Front ^ 1] = true;
+				}
+				presentLayer0();
+				renders++;
+				lastRender = xTaskGetTickCount();
+			}
+
+			const TickType_t now = xTaskGetTickCount();
+			if ((events & RENDER_EVENT_UI) || (now - lastInfo) >= pdMS_TO_TICKS(INFO_REFRESH_MS))
+			{
+				/* renders per second since the last refresh */
+				renderRate = (uint16_t)((renders * 1000) / ((now > lastInfo) ? (now - lastInfo) : 1));
+				renders = 0;
+				lastInfo = now;
+				const uint16_t hotDotIdx = frame->hotDotIndex;
 				hotDotX = 31 - (hotDotIdx % 32);
 				hotDotY = 23 - (hotDotIdx / 32);
-				const uint16_t coldDotIdx = irSensor.getColdDotIndex();
+				const uint16_t coldDotIdx = frame->coldDotIndex;
 				coldDotX = 31 - (coldDotIdx % 32);
 				coldDotY = 23 - (coldDotIdx / 32);
 				cpuUsage = osGetCPUUsage();
-				maxTemp = (int16_t)irSensor.getMaxTemp();
-				minTemp = (int16_t)irSensor.getMinTemp();
+				maxTemp = (int16_t)frame->maxTemp;
+				minTemp = (int16_t)frame->minTemp;
+				/* solved on demand in preview, the map holds no temperatures then */
+				const int16_t spotTemp = (int16_t)irSensor.getPixelTemp(frame, SPOT_PIXEL);
 
 				fbInfoLayer.clear(0x00000000);
 
@@ -236,30 +420,31 @@ static void LTDC_Thread(void const *argument)
 				fbInfoLayer.printf(250, 0, "CPU: %u%%", cpuUsage);
 				fbInfoLayer.printf(250, 12, "T: %04u", xExecutionTime);
 				fbInfoLayer.printf(250, 24, "V: %04u", vis_mode);
+				fbInfoLayer.printf(265, 50, "K:%04u", irSensor.getCalcCycles() / 1000);
+				fbInfoLayer.printf(265, 62, "P:%04u", (uint16_t)(irSensor.getPollsPerFrame() * 100));
+				fbInfoLayer.printf(265, 74, "L:%04u", (uint16_t)(irSensor.getAvgLateness() * 100));
+				fbInfoLayer.printf(265, 86, "B:%04u", irSensor.getBytesPerFrame());
+				fbInfoLayer.printf(265, 98, "I:%04u%c", irSensor.getInitTime(), irSensor.isCalibrationCached() ? 'C' : 'P');
+				const i2c_bus_telemetry_t& busTelemetry = i2cBus.getTelemetry();
+				fbInfoLayer.printf(265, 110, "F:%04u", busTelemetry.faults);
+				fbInfoLayer.printf(265, 122, "R:%04u", busTelemetry.maxRecoveryMs);
+				fbInfoLayer.printf(265, 134, "D:%04u", irSensor.getDroppedFrames());
+				fbInfoLayer.printf(265, 146, "S:%04u", irSensor.getResyncs());
+				fbInfoLayer.printf(265, 158, "N:%04u", renderRate);
+				fbInfoLayer.printf(265, 170, "Q:%04u", presentLatencyMaxUs / 100);
+				fbInfoLayer.printf(265, 182, "X:%04u", framesDropped);
+				fbInfoLayer.printf(265, 194, "C:%03d\x81", spotTemp);
 				fbInfoLayer.printf(250, 225, ARGB_COLOR_RED | 0x8000, ARGB_COLOR_BLACK, "MAX:%u\x81", maxTemp);
 				fbInfoLayer.printf(250, 38, ARGB_COLOR_GREEN | 0x8000, ARGB_COLOR_BLACK, "MIN:%u\x81", minTemp);
-
-				// const TickType_t xTime2 = xTaskGetTickCount();
-				// xExecutionTime = xTime2 - xTime1;
 			}
-			cntr++;
+			events = 0;
 		}
 		else
 		{
 			fbInfoLayer.clear(0x00000000);
 			fbInfoLayer.printf(10, 110, "SENSOR ERROR");
+			osDelay(20);
 		}
-				
-		osDelay(20);
-	}
-}
-
-static void SwapBuffers_Thread(void const *argument)
-{
-	(void) argument;
-	for (;;)
-	{
-		osDelay(2000);
 	}
 }
 
@@ -278,10 +463,11 @@ static void ReadKeys_Thread(void const *argument)
 				continue;
 			}
 			vis_mode++;
-			if (vis_mode > 2)
+			if (vis_mode > VIS_MODE_PREVIEW)
 			{
 				vis_mode = 0;
 			}
+			xTaskNotify(LTDCThreadHandle, RENDER_EVENT_UI, eSetBits);
 
 			isPressed = true;
 		}
@@ -370,7 +556,34 @@ static void SystemClock_Config()
   */
 void HAL_LTDC_ReloadEventCallback(LTDC_HandleTypeDef *hltdc)
 {
-	ReloadFlag = 1;
+	reloadCycles = DWT->CYCCNT;
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	xSemaphoreGiveFromISR(reloadSemaphore, &xHigherPriorityTaskWoken);
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/**
+  * @brief  I2C memory read DMA complete callback, wakes the bus owner.
+  * @param  hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	i2cBus.transferCompleteFromISR(false, &xHigherPriorityTaskWoken);
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/**
+  * @brief  I2C error callback, wakes the bus owner with the error flag set.
+  * @param  hi2c: I2C handle
+  * @retval None
+  */
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	i2cBus.transferCompleteFromISR(true, &xHigherPriorityTaskWoken);
+	portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 /**
@@ -455,7 +668,11 @@ static void LCD_Config()
 	pLayerCfg.WindowY1 = 320;
   
 	/* Pixel Format configuration*/ 
+#if THERMAL_LAYER_L8
+	pLayerCfg.PixelFormat = LTDC_PIXEL_FORMAT_L8;
+#else
 	pLayerCfg.PixelFormat = LTDC_PIXEL_FORMAT_RGB565;
+#endif
   
 	/* Start Address configuration : frame buffer is located at FLASH memory */
 	pLayerCfg.FBStartAdress = FRAMEBUFFER_ADDR;
@@ -32,6 +32,7 @@
 
 /* Private typedef -----------------------------------------------------------*/
 extern LTDC_HandleTypeDef            LtdcHandle;
+extern I2C_HandleTypeDef             I2cHandle;
 
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
@@ -151,6 +152,36 @@ void DMA2D_IRQHandler(void)
 	HAL_DMA2D_IRQHandler(&dma2dHandle);
 }
 
+/**
+  * @brief  This function handles I2C3 event interrupt request.
+  * @param  None
+  * @retval None
+  */
+void I2C3_EV_IRQHandler(void)
+{
+	HAL_I2C_EV_IRQHandler(&I2cHandle);
+}
+
+/**
+  * @brief  This function handles I2C3 error interrupt request.
+  * @param  None
+  * @retval None
+  */
+void I2C3_ER_IRQHandler(void)
+{
+	HAL_I2C_ER_IRQHandler(&I2cHandle);
+}
+
+/**
+  * @brief  This function handles I2C3 RX DMA interrupt request.
+  * @param  None
+  * @retval None
+  */
+void DMA1_Stream2_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(I2cHandle.hdmarx);
+}
+
 /**
   * @brief  This function handles PPP interrupt request.
   * @param  None
@@ -1,37 +1,228 @@
 ﻿#include <thermal.h>
 #include "FreeRTOS.h"
 #include "framebuffer.h"
+#include <cstddef>
 #include <cstring>
 #include <math.h>
 
 #include "task.h"
 
+static float fourthRootSeed[4 << TO_ROOT_TABLE_BITS];
+
+static inline uint32_t floatToBits(const float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline float bitsToFloat(const uint32_t bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+/* Reflected CRC-32 (0xEDB88320), nibble table; chainable like zlib's crc32() */
+static uint32_t crc32(uint32_t crc, const void* data, uint32_t size)
+{
+	static const uint32_t nibbleTable[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+	};
+	const uint8_t* bytes = (const uint8_t*)data;
+	crc = ~crc;
+	while (size--)
+	{
+		crc = (crc >> 4) ^ nibbleTable[(crc ^ *bytes) & 0x0F];
+		crc = (crc >> 4) ^ nibbleTable[(crc ^ (*bytes >> 4)) & 0x0F];
+		bytes++;
+	}
+	return ~crc;
+}
+
+static bool programFlash(const uint32_t address, const void* data, const uint32_t size)
+{
+	const uint32_t* words = (const uint32_t*)data;
+	for (uint32_t i = 0; i < size / 4; i++)
+	{
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i * 4, words[i]) != HAL_OK)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Low bits of an EEPROM field as a two's complement value */
+static inline int32_t signExtend(const uint16_t value, const uint8_t bits)
+{
+	const int32_t field = value & ((1 << bits) - 1);
+	return (field >= (1 << (bits - 1))) ? field - (1 << bits) : field;
+}
+
+/* Doublings needed to bring maxAbs * 2^-scale to at least limit */
+static uint8_t normalizeShift(const uint32_t maxAbs, const uint8_t scale, const uint32_t limit)
+{
+	uint8_t shift = 0;
+	while (maxAbs != 0 && ((uint64_t)maxAbs << shift) < ((uint64_t)limit << scale))
+	{
+		shift++;
+	}
+	return shift;
+}
+
+/* value * 2^shift, rounded half away from zero */
+static inline int32_t roundShift(const int32_t value, const int8_t shift)
+{
+	if (shift >= 0)
+	{
+		return value * (1 << shift);
+	}
+	const int32_t half = 1 << (-shift - 1);
+	return (value < 0) ? -((-value + half) >> -shift) : ((value + half) >> -shift);
+}
+
+/* x^-1/4 seeds indexed by the two low exponent bits and the top mantissa bits, for exponents 124..127 */
+static void buildFourthRootTable()
+{
+	for (uint16_t i = 0; i < (4 << TO_ROOT_TABLE_BITS); i++)
+	{
+		const float mantissa = 1.0f + ((i & ((1 << TO_ROOT_TABLE_BITS) - 1)) + 0.5f) / (1 << TO_ROOT_TABLE_BITS);
+		const float x = ldexpf(mantissa, (i >> TO_ROOT_TABLE_BITS) - 3);
+		fourthRootSeed[i] = 1.0f / sqrtf(sqrtf(x));
+	}
+}
+
+template<to_solver_mode_t SOLVER> static inline float fourthRoot(float x);
+
+/* Frame RAM stays big-endian as the DMA wrote it, REVSH swaps and sign-extends a word in one instruction */
+static inline int16_t frameWord(const uint16_t word)
+{
+	return (int16_t)__REVSH((int16_t)word);
+}
+
+template<> inline float fourthRoot<TO_SOLVER_EXACT>(const float x)
+{
+	return sqrtf(sqrtf(x));
+}
+
+/* y ~ x^-1/4 from the exponent bits, Newton on y^-4 = x, then x^1/4 = x * y^3 */
+template<> inline float fourthRoot<TO_SOLVER_FAST>(const float x)
+{
+	float y = bitsToFloat(0x4F587550 - (floatToBits(x) >> 2));
+	float y2 = y * y;
+	y = y * (1.25f - 0.25f * x * y2 * y2);
+	y2 = y * y;
+	y = y * (1.25f - 0.25f * x * y2 * y2);
+	return x * y * y * y;
+}
+
+template<> inline float fourthRoot<TO_SOLVER_TABLE>(const float x)
+{
+	const uint32_t bits = floatToBits(x);
+	const uint32_t index = (bits >> (23 - TO_ROOT_TABLE_BITS)) & ((4 << TO_ROOT_TABLE_BITS) - 1);
+	const int32_t quarterExp = ((int32_t)(bits >> 23) - 124) >> 2;
+	float y = bitsToFloat(floatToBits(fourthRootSeed[index]) - (quarterExp << 23));
+	const float y2 = y * y;
+	y = y * (1.25f - 0.25f * x * y2 * y2);
+	return x * y * y * y;
+}
+
 IRSensor::IRSensor()
 {
 	this->dma2dHandler = NULL;
 	this->fb_addr = 0;
+	this->colorScheme = NULL;
+	this->colorSchemeVersion = 0;
+	this->pixelFormat = IR_PIXEL_RGB565;
 	this->minTemp = 0;
 	this->maxTemp = 0;
 	this->layer = 0;
 	this->fbSizeX = 0;
 	this->fbSizeY = 0;
+	this->offsetCacheValid = false;
+	this->offsetCacheTa = 0;
+	this->offsetCacheVdd = 0;
+	this->offsetCacheTaEps = OFFSET_CACHE_TA_EPS;
+	this->offsetCacheVddEps = OFFSET_CACHE_VDD_EPS;
+	this->offsetCacheRebuilds = 0;
+	this->offsetCacheHits = 0;
+	this->toSolverMode = TO_SOLVER_EXACT;
+	this->toLutActive = 0;
+	this->toLutValid = false;
+	this->toLutBuildPos = -1;
+	this->bus = NULL;
+	this->readTask = NULL;
+	this->readGeneration = 0;
+	this->readError = false;
+	this->controlRegister = 0;
+	this->calibrationCached = false;
+	this->calibrationStorePending = false;
+	this->initTimeMs = 0;
+	this->controlRegisterStale = false;
+	this->controlCheckTick = 0;
+	this->controlRestores = 0;
+	this->lastBusFaults = 0;
+	this->droppedFrames = 0;
+	this->burstStalls = 0;
+	this->subPage = 0;
+	this->freeFrames = NULL;
+	this->readyFrames = NULL;
+	this->frameData = rawFrames[0].data;
+	this->frameControl = 0;
+	memset(this->rawFrames, 0, sizeof(this->rawFrames));
+	this->frameBytes = 0;
+	this->framePeriodMs = 2000.0f / (1 << MLX90640_16_HZ);
+	this->lastReadyTick = 0;
+	this->lastReadyValid = false;
+	this->subPageLeftOver = false;
+	this->framePolls = 0;
+	this->frameWaits = 0;
+	this->framesLatenessMs = 0;
+	this->frameParams.lut = NULL;
+	this->readImageCycles = 0;
+	this->calcCycles = 0;
+	this->calcCyclesMax = 0;
+	this->coldDotIndex = 0;
+	this->hotDotIndex = 0;
+	memset(this->subPageStats, 0, sizeof(this->subPageStats));
+	memset(&this->frameStats, 0, sizeof(this->frameStats));
+	memset(this->subPageImageStats, 0, sizeof(this->subPageImageStats));
+	memset(&this->imageStats, 0, sizeof(this->imageStats));
+	memset(this->irImage, 0, sizeof(this->irImage));
+	this->processMode = IR_PROCESS_RADIOMETRIC;
+	this->lastProcessMode = IR_PROCESS_RADIOMETRIC;
+	this->displayMode = IR_PROCESS_RADIOMETRIC;
+	this->processedSubPages = 0;
+	this->subPageValid = false;
+	this->lastSubPage = 0;
+	this->lastSubPageTick = 0;
+	this->pairPending = false;
+	memset(&this->frameInfo, 0, sizeof(this->frameInfo));
+	this->subPageRepeats = 0;
+	this->subPageSkips = 0;
+	this->resyncs = 0;
+	this->badPixelCount = 0;
+	memset(this->badPixelMap, 0, sizeof(this->badPixelMap));
+	buildSubPageTables();
+	buildReadoutPlan();
+	buildFourthRootTable();
 }
 
 IRSensor::~IRSensor()
 {
 }
 
-bool IRSensor::init(DMA2D_HandleTypeDef* dma2dHandler, uint8_t layer, const uint32_t fb_addr, const uint16_t fbSizeX, const uint16_t fbSizeY, const uint8_t* colorScheme)
+bool IRSensor::init(I2CBus* bus, DMA2D_HandleTypeDef* dma2dHandler, uint8_t layer, const uint32_t fb_addr, const uint16_t fbSizeX, const uint16_t fbSizeY, const uint8_t* colorScheme)
 {
     setFbAddress(fb_addr);
+	this->bus = bus;
 	this->dma2dHandler = dma2dHandler;
 	this->layer = layer;
 	this->setColorScheme(colorScheme);
 	this->setFbSize(fbSizeX, fbSizeY);
-
-    uint16_t statusRegister = I2Cx_ReadData16(MLX90640_ADDR, 0x8000);
-    uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    uint16_t controlRegister2 = I2Cx_ReadData16(MLX90640_ADDR, 0x800F);
+	const uint32_t initStart = HAL_GetTick();
 
     //read MLX info
 	readSerialNumber();
@@ -40,23 +231,133 @@ bool IRSensor::init(DMA2D_HandleTypeDef* dma2dHandler, uint8_t layer, const uint
 	    return false;
     }
 
+    /* seed the shadow once, every later change writes through */
+    this->controlRegister = bus->readData16(MLX90640_ADDR, 0x800D, I2C_BUS_PRIORITY_HIGH);
+    this->controlCheckTick = xTaskGetTickCount();
     setADCResolution(MLX90640_ADC_18BIT);
     setRefreshRate(MLX90640_16_HZ);
     setMlxMode(MLX90640_CHESS);
 
-    mlx90640_refreshrate refreshRate = readRefreshRate();
-    mlx90640_resolution_t adcResolution = readADCResolution();
-    mlx90640_mode_t mode = readMlxMode();
+    /* warm boot: the parsed calibration comes from flash, no EEPROM read and no parse.
+       A cold boot leaves the flash write for later, the sector erase alone takes 1-2 s */
+    calibrationCached = loadCalibrationCache();
+    if (!calibrationCached)
+    {
+	    readMlxEE();
+	    convertMlxEEToParams();
+	    calibrationStorePending = true;
+    }
+    expandMlxParams();
+
+    if (freeFrames == NULL)
+    {
+	    freeFrames = xQueueCreate(RAW_FRAME_POOL, sizeof(raw_frame_t*));
+	    readyFrames = xQueueCreate(RAW_FRAME_POOL, sizeof(raw_frame_t*));
+	    for (uint8_t i = 0; i < RAW_FRAME_POOL; i++)
+	    {
+		    raw_frame_t* raw = &rawFrames[i];
+		    xQueueSendToBack(freeFrames, &raw, 0);
+	    }
+    }
 
-	readMlxEE();
-    convertMlxEEToParams();
+    /* DWT cycle counter for readImage profiling */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
+    this->initTimeMs = HAL_GetTick() - initStart;
     return true;
 }
 
+bool IRSensor::loadCalibrationCache()
+{
+	const calib_cache_t* cache = (const calib_cache_t*)CALIB_CACHE_ADDR;
+	if (cache->header.magic != CALIB_CACHE_MAGIC || cache->header.version != CALIB_CACHE_VERSION ||
+		cache->header.size != sizeof(paramsMLX90640_t) ||
+		memcmp(cache->header.serial, mlxSerialNumber, sizeof(mlxSerialNumber)) != 0)
+	{
+		return false;
+	}
+	uint32_t crc = crc32(0, &cache->header, sizeof(cache->header));
+	crc = crc32(crc, &cache->params, sizeof(cache->params));
+	if (crc != cache->crc)
+	{
+		return false;
+	}
+	memcpy(&mlxParams, &cache->params, sizeof(mlxParams));
+	return true;
+}
+
+/* Erase the cache sector and program header, params, then the CRC, so an interrupted write never validates */
+bool IRSensor::storeCalibrationCache()
+{
+	calib_cache_header_t header;
+	header.magic = CALIB_CACHE_MAGIC;
+	header.version = CALIB_CACHE_VERSION;
+	memcpy(header.serial, mlxSerialNumber, sizeof(header.serial));
+	header.size = sizeof(paramsMLX90640_t);
+	uint32_t crc = crc32(0, &header, sizeof(header));
+	crc = crc32(crc, &mlxParams, sizeof(mlxParams));
+
+	FLASH_EraseInitTypeDef erase;
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Banks = FLASH_BANK_2;
+	erase.Sector = CALIB_CACHE_SECTOR;
+	erase.NbSectors = 1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+	uint32_t sectorError = 0;
+
+	HAL_FLASH_Unlock();
+	bool ok = (HAL_FLASHEx_Erase(&erase, &sectorError) == HAL_OK);
+	ok = ok && programFlash(CALIB_CACHE_ADDR + offsetof(calib_cache_t, header), &header, sizeof(header));
+	ok = ok && programFlash(CALIB_CACHE_ADDR + offsetof(calib_cache_t, params), &mlxParams, sizeof(mlxParams));
+	ok = ok && programFlash(CALIB_CACHE_ADDR + offsetof(calib_cache_t, crc), &crc, sizeof(crc));
+	HAL_FLASH_Lock();
+	return ok;
+}
+
+bool IRSensor::isCalibrationCached()
+{
+	return this->calibrationCached;
+}
+
+/* Writes a calibration parsed at cold boot to the cache. The sector erase busy-waits for 1-2 s,
+   so this runs once the sensor is streaming instead of inside init(). */
+bool IRSensor::storePendingCalibration()
+{
+	if (!calibrationStorePending)
+	{
+		return false;
+	}
+	calibrationStorePending = false;
+	return storeCalibrationCache();
+}
+
+uint32_t IRSensor::getInitTime()
+{
+	return this->initTimeMs;
+}
+
 void IRSensor::setColorScheme(const uint8_t* colorScheme)
 {
 	this->colorScheme = colorScheme;
+	this->colorSchemeVersion++;
+}
+
+uint32_t IRSensor::getColorSchemeVersion()
+{
+	return this->colorSchemeVersion;
+}
+
+/* L8 renders palette indices, the color scheme then lives in the layer CLUT (see buildClut) */
+void IRSensor::setPixelFormat(const ir_pixel_format_t format)
+{
+	this->pixelFormat = format;
+}
+
+ir_pixel_format_t IRSensor::getPixelFormat()
+{
+	return this->pixelFormat;
 }
 
 
@@ -74,7 +375,7 @@ void IRSensor::setFbSize(const uint16_t fbSizeX, const uint16_t fbSizeY)
 
 void IRSensor::readMlxEE()
 {
-	I2Cx_ReadBuffer16(MLX90640_ADDR, 0x2400, mlxEE, sizeof(mlxEE));
+	bus->transfer(I2C_BUS_READ16, MLX90640_ADDR, 0x2400, mlxEE, sizeof(mlxEE), I2C_BUS_PRIORITY_HIGH);
 }
 
 void IRSensor::convertMlxEEToParams()
@@ -107,7 +408,7 @@ void IRSensor::convertMlxEEToParams()
     }
     KtPTAT = KtPTAT/8;
 	const int16_t vPTAT25 = mlxEE[49];
-	const float alphaPTAT = (mlxEE[16] & 0xF000) / pow(2, (double)14) + 8.0f;
+	const float alphaPTAT = (mlxEE[16] & 0xF000) / 16384.0f + 8.0f;
     
     mlxParams.KvPTAT = KvPTAT;
     mlxParams.KtPTAT = KtPTAT;    
@@ -177,341 +478,9 @@ void IRSensor::convertMlxEEToParams()
         mlxParams.ksTo[i] = mlxParams.ksTo[i] / KsToScale;
     } 
     
-    mlxParams.ksTo[4] = -0.0002;
-
-	/* Alpha */
-	int accRow[24];
-    int accColumn[32];
-	float alphaTemp[768];
-
-	const uint8_t accRemScale = mlxEE[32] & 0x000F;
-	const uint8_t accColumnScale = (mlxEE[32] & 0x00F0) >> 4;
-	const uint8_t accRowScale = (mlxEE[32] & 0x0F00) >> 8;
-	uint8_t alphaScale = ((mlxEE[32] & 0xF000) >> 12) + 30;
-	const int alphaRef = mlxEE[33];
-    
-	int p = 0;
-
-	for(int i = 0; i < 6; i++)
-    {
-        p = i * 4;
-        accRow[p + 0] = (mlxEE[34 + i] & 0x000F);
-        accRow[p + 1] = (mlxEE[34 + i] & 0x00F0) >> 4;
-        accRow[p + 2] = (mlxEE[34 + i] & 0x0F00) >> 8;
-        accRow[p + 3] = (mlxEE[34 + i] & 0xF000) >> 12;
-    }
-    
-    for(int i = 0; i < 24; i++)
-    {
-        if (accRow[i] > 7)
-        {
-            accRow[i] = accRow[i] - 16;
-        }
-    }
-    
-    for(int i = 0; i < 8; i++)
-    {
-        p = i * 4;
-        accColumn[p + 0] = (mlxEE[40 + i] & 0x000F);
-        accColumn[p + 1] = (mlxEE[40 + i] & 0x00F0) >> 4;
-        accColumn[p + 2] = (mlxEE[40 + i] & 0x0F00) >> 8;
-        accColumn[p + 3] = (mlxEE[40 + i] & 0xF000) >> 12;
-    }
-    
-    for(int i = 0; i < 32; i ++)
-    {
-        if (accColumn[i] > 7)
-        {
-            accColumn[i] = accColumn[i] - 16;
-        }
-    }
-
-    for(int i = 0; i < 24; i++)
-    {
-        for(int j = 0; j < 32; j ++)
-        {
-            p = 32 * i +j;
-            alphaTemp[p] = (mlxEE[64 + p] & 0x03F0) >> 4;
-            if (alphaTemp[p] > 31)
-            {
-                alphaTemp[p] = alphaTemp[p] - 64;
-            }
-            alphaTemp[p] = alphaTemp[p]*(1 << accRemScale);
-            alphaTemp[p] = (alphaRef + (accRow[i] << accRowScale) + (accColumn[j] << accColumnScale) + alphaTemp[p]);
-            alphaTemp[p] = alphaTemp[p] / pow(2,(double)alphaScale);
-            alphaTemp[p] = alphaTemp[p] - mlxParams.tgc * (mlxParams.cpAlpha[0] + mlxParams.cpAlpha[1])/2;
-            alphaTemp[p] = SCALEALPHA/alphaTemp[p];
-        }
-    }
-
-	float temp = alphaTemp[0];
-    for(int i = 1; i < 768; i++)
-    {
-        if (alphaTemp[i] > temp)
-        {
-            temp = alphaTemp[i];
-        }
-    }
-
-	alphaScale = 0;
-    while(temp < 32768)
-    {
-        temp = temp*2;
-        alphaScale = alphaScale + 1;
-    } 
-    
-    for(int i = 0; i < 768; i++)
-    {
-        temp = alphaTemp[i] * pow(2,(double)alphaScale);        
-        mlxParams.alpha[i] = (temp + 0.5);        
-        
-    } 
-
-    mlxParams.alphaScale = alphaScale;
-
-	/* Offset */
-	int occRow[24];
-    int occColumn[32];
-    int po = 0;
-
-	const uint8_t occRemScale = (mlxEE[16] & 0x000F);
-	const uint8_t occColumnScale = (mlxEE[16] & 0x00F0) >> 4;
-	const uint8_t occRowScale = (mlxEE[16] & 0x0F00) >> 8;
-    int16_t offsetRef = mlxEE[17];
-    if (offsetRef > 32767)
-    {
-        offsetRef = offsetRef - 65536;
-    }
-    
-    for(int i = 0; i < 6; i++)
-    {
-        po = i * 4;
-        occRow[po + 0] = (mlxEE[18 + i] & 0x000F);
-        occRow[po + 1] = (mlxEE[18 + i] & 0x00F0) >> 4;
-        occRow[po + 2] = (mlxEE[18 + i] & 0x0F00) >> 8;
-        occRow[po + 3] = (mlxEE[18 + i] & 0xF000) >> 12;
-    }
-    
-    for(int i = 0; i < 24; i++)
-    {
-        if (occRow[i] > 7)
-        {
-            occRow[i] = occRow[i] - 16;
-        }
-    }
-    
-    for(int i = 0; i < 8; i++)
-    {
-        po = i * 4;
-        occColumn[po + 0] = (mlxEE[24 + i] & 0x000F);
-        occColumn[po + 1] = (mlxEE[24 + i] & 0x00F0) >> 4;
-        occColumn[po + 2] = (mlxEE[24 + i] & 0x0F00) >> 8;
-        occColumn[po + 3] = (mlxEE[24 + i] & 0xF000) >> 12;
-    }
-    
-    for(int i = 0; i < 32; i ++)
-    {
-        if (occColumn[i] > 7)
-        {
-            occColumn[i] = occColumn[i] - 16;
-        }
-    }
-
-    for(int i = 0; i < 24; i++)
-    {
-        for(int j = 0; j < 32; j ++)
-        {
-            po = 32 * i +j;
-            mlxParams.offset[po] = (mlxEE[64 + po] & 0xFC00) >> 10;
-            if (mlxParams.offset[po] > 31)
-            {
-                mlxParams.offset[po] = mlxParams.offset[po] - 64;
-            }
-            mlxParams.offset[po] = mlxParams.offset[po]*(1 << occRemScale);
-            mlxParams.offset[po] = (offsetRef + (occRow[i] << occRowScale) + (occColumn[j] << occColumnScale) + mlxParams.offset[po]);
-        }
-    }
-
-	/* KtaPixel */
-	int pkp = 0;
-    int8_t KtaRC[4];
-    int8_t KtaRoCo;
-    int8_t KtaRoCe;
-    int8_t KtaReCo;
-    int8_t KtaReCe;
-    uint8_t ktaScale1;
-    uint8_t ktaScale2;
-    uint8_t split;
-    float ktaTemp[768];
-    float tempKta;
-    
-    KtaRoCo = (mlxEE[54] & 0xFF00) >> 8;
-    if (KtaRoCo > 127)
-    {
-        KtaRoCo = KtaRoCo - 256;
-    }
-    KtaRC[0] = KtaRoCo;
-    
-    KtaReCo = (mlxEE[54] & 0x00FF);
-    if (KtaReCo > 127)
-    {
-        KtaReCo = KtaReCo - 256;
-    }
-    KtaRC[2] = KtaReCo;
-      
-    KtaRoCe = (mlxEE[55] & 0xFF00) >> 8;
-    if (KtaRoCe > 127)
-    {
-        KtaRoCe = KtaRoCe - 256;
-    }
-    KtaRC[1] = KtaRoCe;
-      
-    KtaReCe = (mlxEE[55] & 0x00FF);
-    if (KtaReCe > 127)
-    {
-        KtaReCe = KtaReCe - 256;
-    }
-    KtaRC[3] = KtaReCe;
-  
-    ktaScale1 = ((mlxEE[56] & 0x00F0) >> 4) + 8;
-    ktaScale2 = (mlxEE[56] & 0x000F);
-
-    for(int i = 0; i < 24; i++)
-    {
-        for(int j = 0; j < 32; j ++)
-        {
-            pkp = 32 * i +j;
-            split = 2*(pkp/32 - (pkp/64)*2) + pkp % 2;
-            ktaTemp[pkp] = (mlxEE[64 + pkp] & 0x000E) >> 1;
-            if (ktaTemp[pkp] > 3)
-            {
-                ktaTemp[pkp] = ktaTemp[pkp] - 8;
-            }
-            ktaTemp[pkp] = ktaTemp[pkp] * (1 << ktaScale2);
-            ktaTemp[pkp] = KtaRC[split] + ktaTemp[pkp];
-            ktaTemp[pkp] = ktaTemp[pkp] / pow(2,(double)ktaScale1);
-        }
-    }
-    
-    tempKta = fabs(ktaTemp[0]);
-    for(int i = 1; i < 768; i++)
-    {
-        if (fabs(ktaTemp[i]) > tempKta)
-        {
-            tempKta = fabs(ktaTemp[i]);
-        }
-    }
-    
-    ktaScale1 = 0;
-    while(tempKta < 64)
-    {
-        tempKta = tempKta*2;
-        ktaScale1 = ktaScale1 + 1;
-    }    
-     
-    for(int i = 0; i < 768; i++)
-    {
-        tempKta = ktaTemp[i] * pow(2,(double)ktaScale1);
-        if (tempKta < 0)
-        {
-            mlxParams.kta[i] = (tempKta - 0.5);
-        }
-        else
-        {
-            mlxParams.kta[i] = (tempKta + 0.5);
-        }        
-        
-    } 
-    
-    mlxParams.ktaScale = ktaScale1;
-
-    /* KvPixel */
-    int pKvp = 0;
-    int8_t KvT[4];
-    int8_t KvRoCo;
-    int8_t KvRoCe;
-    int8_t KvReCo;
-    int8_t KvReCe;
-    uint8_t kvScale;
-    uint8_t splitKvp;
-    float kvTemp[768];
-    float tempKvp;
-
-    KvRoCo = (mlxEE[52] & 0xF000) >> 12;
-    if (KvRoCo > 7)
-    {
-        KvRoCo = KvRoCo - 16;
-    }
-    KvT[0] = KvRoCo;
-    
-    KvReCo = (mlxEE[52] & 0x0F00) >> 8;
-    if (KvReCo > 7)
-    {
-        KvReCo = KvReCo - 16;
-    }
-    KvT[2] = KvReCo;
-      
-    KvRoCe = (mlxEE[52] & 0x00F0) >> 4;
-    if (KvRoCe > 7)
-    {
-        KvRoCe = KvRoCe - 16;
-    }
-    KvT[1] = KvRoCe;
-      
-    KvReCe = (mlxEE[52] & 0x000F);
-    if (KvReCe > 7)
-    {
-        KvReCe = KvReCe - 16;
-    }
-    KvT[3] = KvReCe;
-  
-    kvScale = (mlxEE[56] & 0x0F00) >> 8;
-
-
-    for(int i = 0; i < 24; i++)
-    {
-        for(int j = 0; j < 32; j ++)
-        {
-            pKvp = 32 * i +j;
-            splitKvp = 2*(pKvp/32 - (pKvp/64)*2) + pKvp%2;
-            kvTemp[pKvp] = KvT[splitKvp];
-            kvTemp[pKvp] = kvTemp[pKvp] / pow(2,(double)kvScale);
-        }
-    }
-    
-    tempKvp = fabs(kvTemp[0]);
-    for(int i = 1; i < 768; i++)
-    {
-        if (fabs(kvTemp[i]) > tempKvp)
-        {
-            tempKvp = fabs(kvTemp[i]);
-        }
-    }
-    
-    kvScale = 0;
-    while(tempKvp < 64)
-    {
-        tempKvp = tempKvp*2;
-        kvScale = kvScale + 1;
-    }    
-     
-    for(int i = 0; i < 768; i++)
-    {
-        tempKvp = kvTemp[i] * pow(2,(double)kvScale);
-        if (tempKvp < 0)
-        {
-            mlxParams.kv[i] = (tempKvp - 0.5);
-        }
-        else
-        {
-            mlxParams.kv[i] = (tempKvp + 0.5);
-        }        
-        
-    } 
-    
-    mlxParams.kvScale = kvScale;
+    mlxParams.ksTo[4] = -0.0002f;
 
-    /* CP */
+    /* CP, before alpha: the pixel alphas are corrected with these */
     float alphaSP[2];
     int16_t offsetSP[2];
     float cpKv;
@@ -540,7 +509,7 @@ void IRSensor::convertMlxEEToParams()
     {
         alphaSP[0] = alphaSP[0] - 1024;
     }
-    alphaSP[0] = alphaSP[0] /  pow(2,(double)alphaScaleCp);
+    alphaSP[0] = ldexpf(alphaSP[0], -alphaScaleCp);
     
     alphaSP[1] = (mlxEE[57] & 0xFC00) >> 10;
     if (alphaSP[1] > 31)
@@ -555,7 +524,7 @@ void IRSensor::convertMlxEEToParams()
         cpKta = cpKta - 256;
     }
     ktaScale1Cp = ((mlxEE[56] & 0x00F0) >> 4) + 8;    
-    mlxParams.cpKta = cpKta / pow(2,(double)ktaScale1Cp);
+    mlxParams.cpKta = ldexpf(cpKta, -ktaScale1Cp);
     
     cpKv = (mlxEE[59] & 0xFF00) >> 8;
     if (cpKv > 127)
@@ -563,42 +532,161 @@ void IRSensor::convertMlxEEToParams()
         cpKv = cpKv - 256;
     }
     kvScaleCp = (mlxEE[56] & 0x0F00) >> 8;
-    mlxParams.cpKv = cpKv / pow(2,(double)kvScaleCp);
+    mlxParams.cpKv = ldexpf(cpKv, -kvScaleCp);
        
     mlxParams.cpAlpha[0] = alphaSP[0];
     mlxParams.cpAlpha[1] = alphaSP[1];
     mlxParams.cpOffset[0] = offsetSP[0];
     mlxParams.cpOffset[1] = offsetSP[1];
 
-    /* CILC */
-    float ilChessC[3];
-    uint8_t calibrationModeEE;
-    
-    calibrationModeEE = (mlxEE[10] & 0x0800) >> 4;
-    calibrationModeEE = calibrationModeEE ^ 0x80;
+	/* Row/column tables, 4-bit signed nibbles */
+	int8_t accRow[24];
+	int8_t accColumn[32];
+	int8_t occRow[24];
+	int8_t occColumn[32];
+	for (uint8_t i = 0; i < 24; i++)
+	{
+		accRow[i] = (int8_t)signExtend(mlxEE[34 + i / 4] >> ((i % 4) * 4), 4);
+		occRow[i] = (int8_t)signExtend(mlxEE[18 + i / 4] >> ((i % 4) * 4), 4);
+	}
+	for (uint8_t i = 0; i < 32; i++)
+	{
+		accColumn[i] = (int8_t)signExtend(mlxEE[40 + i / 4] >> ((i % 4) * 4), 4);
+		occColumn[i] = (int8_t)signExtend(mlxEE[24 + i / 4] >> ((i % 4) * 4), 4);
+	}
 
-    ilChessC[0] = (mlxEE[53] & 0x003F);
-    if (ilChessC[0] > 31)
-    {
-        ilChessC[0] = ilChessC[0] - 64;
-    }
-    ilChessC[0] = ilChessC[0] / 16.0f;
-    
-    ilChessC[1] = (mlxEE[53] & 0x07C0) >> 6;
-    if (ilChessC[1] > 15)
-    {
-        ilChessC[1] = ilChessC[1] - 32;
-    }
-    ilChessC[1] = ilChessC[1] / 2.0f;
-    
-    ilChessC[2] = (mlxEE[53] & 0xF800) >> 11;
-    if (ilChessC[2] > 15)
-    {
-        ilChessC[2] = ilChessC[2] - 32;
-    }
-    ilChessC[2] = ilChessC[2] / 8.0f;
-    
-    mlxParams.calibrationModeEE = calibrationModeEE;
+	/* Alpha: raw sums are exact integers, the smallest one gives the largest SCALEALPHA/alpha */
+	const uint8_t accRemScale = mlxEE[32] & 0x000F;
+	const uint8_t accColumnScale = (mlxEE[32] & 0x00F0) >> 4;
+	const uint8_t accRowScale = (mlxEE[32] & 0x0F00) >> 8;
+	const uint8_t alphaEEScale = ((mlxEE[32] & 0xF000) >> 12) + 30;
+	const int32_t alphaRef = mlxEE[33];
+	const float alphaCorr = mlxParams.tgc * (mlxParams.cpAlpha[0] + mlxParams.cpAlpha[1])/2;
+
+	/* Offset */
+	const uint8_t occRemScale = (mlxEE[16] & 0x000F);
+	const uint8_t occColumnScale = (mlxEE[16] & 0x00F0) >> 4;
+	const uint8_t occRowScale = (mlxEE[16] & 0x0F00) >> 8;
+	const int32_t offsetRef = (int16_t)mlxEE[17];
+
+	/* Kta: row/column parity split, [0] odd row odd column ... [3] even row even column */
+	int8_t KtaRC[4];
+	KtaRC[0] = (int8_t)(mlxEE[54] >> 8);
+	KtaRC[1] = (int8_t)(mlxEE[55] >> 8);
+	KtaRC[2] = (int8_t)(mlxEE[54] & 0x00FF);
+	KtaRC[3] = (int8_t)(mlxEE[55] & 0x00FF);
+	const uint8_t ktaEEScale1 = ((mlxEE[56] & 0x00F0) >> 4) + 8;
+	const uint8_t ktaScale2 = (mlxEE[56] & 0x000F);
+
+	/* Kv: a single value per split */
+	int8_t KvT[4];
+	KvT[0] = (int8_t)signExtend(mlxEE[52] >> 12, 4);
+	KvT[1] = (int8_t)signExtend(mlxEE[52] >> 4, 4);
+	KvT[2] = (int8_t)signExtend(mlxEE[52] >> 8, 4);
+	KvT[3] = (int8_t)signExtend(mlxEE[52], 4);
+	const uint8_t kvEEScale = (mlxEE[56] & 0x0F00) >> 8;
+
+	/* First pass: extremes only, so no per-pixel float temporaries are kept */
+	int32_t alphaSumMin = INT32_MAX;
+	uint32_t ktaAbsMax = 0;
+	for (uint16_t p = 0; p < 768; p++)
+	{
+		const uint16_t ee = mlxEE[64 + p];
+		const int32_t alphaSum = alphaRef + accRow[p / 32] * (1 << accRowScale) + accColumn[p % 32] * (1 << accColumnScale) +
+			signExtend(ee >> 4, 6) * (1 << accRemScale);
+		if (alphaSum < alphaSumMin)
+		{
+			alphaSumMin = alphaSum;
+		}
+		const int32_t kta = KtaRC[2 * ((p / 32) & 1) + (p & 1)] + signExtend(ee >> 1, 3) * (1 << ktaScale2);
+		const uint32_t ktaAbs = (kta < 0) ? -kta : kta;
+		if (ktaAbs > ktaAbsMax)
+		{
+			ktaAbsMax = ktaAbs;
+		}
+	}
+
+	uint32_t kvAbsMax = 0;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		const uint32_t kvAbs = (KvT[i] < 0) ? -KvT[i] : KvT[i];
+		if (kvAbs > kvAbsMax)
+		{
+			kvAbsMax = kvAbs;
+		}
+	}
+
+	/* Output scales: alpha into [32768, 65536), kta/kv into [64, 128) */
+	float temp = SCALEALPHA/(ldexpf((float)alphaSumMin, -alphaEEScale) - alphaCorr);
+	uint8_t alphaScale = 0;
+	while(temp < 32768)
+	{
+		temp = temp*2;
+		alphaScale = alphaScale + 1;
+	}
+	const uint8_t ktaScale = normalizeShift(ktaAbsMax, ktaEEScale1, 64);
+	const uint8_t kvScale = normalizeShift(kvAbsMax, kvEEScale, 64);
+
+	int8_t kvSplit[4];
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		kvSplit[i] = (int8_t)roundShift(KvT[i], kvScale - kvEEScale);
+	}
+
+	/* Second pass: every per-pixel parameter from one read of its EEPROM word */
+	for (uint16_t p = 0; p < 768; p++)
+	{
+		const uint16_t ee = mlxEE[64 + p];
+		const uint8_t row = p / 32;
+		const uint8_t column = p % 32;
+		const uint8_t split = 2 * (row & 1) + (p & 1);
+
+		const int32_t alphaSum = alphaRef + accRow[row] * (1 << accRowScale) + accColumn[column] * (1 << accColumnScale) +
+			signExtend(ee >> 4, 6) * (1 << accRemScale);
+		const float alpha = SCALEALPHA/(ldexpf((float)alphaSum, -alphaEEScale) - alphaCorr);
+		mlxParams.alpha[p] = (uint16_t)(ldexpf(alpha, alphaScale) + 0.5f);
+
+		mlxParams.offset[p] = (int16_t)(offsetRef + occRow[row] * (1 << occRowScale) + occColumn[column] * (1 << occColumnScale) +
+			signExtend(ee >> 10, 6) * (1 << occRemScale));
+
+		const int32_t kta = KtaRC[split] + signExtend(ee >> 1, 3) * (1 << ktaScale2);
+		mlxParams.kta[p] = (int8_t)roundShift(kta, ktaScale - ktaEEScale1);
+		mlxParams.kv[p] = kvSplit[split];
+	}
+
+	mlxParams.alphaScale = alphaScale;
+	mlxParams.ktaScale = ktaScale;
+	mlxParams.kvScale = kvScale;
+
+    /* CILC */
+    float ilChessC[3];
+    uint8_t calibrationModeEE;
+    
+    calibrationModeEE = (mlxEE[10] & 0x0800) >> 11;
+    calibrationModeEE = calibrationModeEE ^ 0x01;
+
+    ilChessC[0] = (mlxEE[53] & 0x003F);
+    if (ilChessC[0] > 31)
+    {
+        ilChessC[0] = ilChessC[0] - 64;
+    }
+    ilChessC[0] = ilChessC[0] / 16.0f;
+    
+    ilChessC[1] = (mlxEE[53] & 0x07C0) >> 6;
+    if (ilChessC[1] > 15)
+    {
+        ilChessC[1] = ilChessC[1] - 32;
+    }
+    ilChessC[1] = ilChessC[1] / 2.0f;
+    
+    ilChessC[2] = (mlxEE[53] & 0xF800) >> 11;
+    if (ilChessC[2] > 15)
+    {
+        ilChessC[2] = ilChessC[2] - 32;
+    }
+    ilChessC[2] = ilChessC[2] / 8.0f;
+    
+    mlxParams.calibrationModeEE = calibrationModeEE;
     mlxParams.ilChessC[0] = ilChessC[0];
     mlxParams.ilChessC[1] = ilChessC[1];
     mlxParams.ilChessC[2] = ilChessC[2];
@@ -632,393 +720,1185 @@ void IRSensor::convertMlxEEToParams()
     } 
 }
 
+/* Unpack scaled per-pixel coefficients into ready-to-use tables, so the To loop has no divisions */
+void IRSensor::expandMlxParams()
+{
+	const float alphaNumerator = ldexpf(SCALEALPHA, mlxParams.alphaScale);
+
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		const int8_t ilPattern = (i / 32) & 1;
+		const int8_t conversionPattern = ((i + 2) / 4 - (i + 3) / 4 + (i + 1) / 4 - i / 4) * (1 - 2 * ilPattern);
+
+		pixKta[i] = ldexpf(mlxParams.kta[i], -mlxParams.ktaScale);
+		pixKv[i] = ldexpf(mlxParams.kv[i], -mlxParams.kvScale);
+		pixAlpha[i] = alphaNumerator / mlxParams.alpha[i];
+		pixIlChessCorr[i] = mlxParams.ilChessC[2] * (2 * ilPattern - 1) - mlxParams.ilChessC[1] * conversionPattern;
+	}
+	offsetCacheValid = false;
+	buildBadPixelMap();
+}
+
+/* Defect bitmap for O(1) IsPixelBad, plus the neighbour weights used to patch each defect */
+void IRSensor::buildBadPixelMap()
+{
+	memset(badPixelMap, 0, sizeof(badPixelMap));
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		if (mlxParams.brokenPixels[i] < 768)
+		{
+			badPixelMap[mlxParams.brokenPixels[i] >> 5] |= 1UL << (mlxParams.brokenPixels[i] & 31);
+		}
+		if (mlxParams.outlierPixels[i] < 768)
+		{
+			badPixelMap[mlxParams.outlierPixels[i] >> 5] |= 1UL << (mlxParams.outlierPixels[i] & 31);
+		}
+	}
+
+	badPixelCount = 0;
+	for (uint16_t i = 0; i < 768 && badPixelCount < BAD_PIXELS_MAX; i++)
+	{
+		if (!IsPixelBad(i))
+		{
+			continue;
+		}
+
+		static const int8_t rowShift[4] = { 0, 0, -1, 1 };
+		static const int8_t colShift[4] = { -1, 1, 0, 0 };
+		bad_pixel_patch_t* patch = &badPixelPatches[badPixelCount++];
+		uint8_t good = 0;
+
+		patch->pixel = i;
+		for (uint8_t j = 0; j < 4; j++)
+		{
+			const int16_t r = i / 32 + rowShift[j];
+			const int16_t c = i % 32 + colShift[j];
+			if (r >= 0 && r < 24 && c >= 0 && c < 32 && !IsPixelBad(r * 32 + c))
+			{
+				patch->neighbors[good++] = r * 32 + c;
+			}
+		}
+
+		/* unused slots point at the pixel itself with zero weight; no good neighbour keeps the raw value */
+		for (uint8_t j = 0; j < 4; j++)
+		{
+			if (j >= good)
+			{
+				patch->neighbors[j] = i;
+			}
+			patch->weights[j] = (good == 0) ? ((j == 0) ? 1.0f : 0.0f) : ((j < good) ? 1.0f / good : 0.0f);
+		}
+	}
+}
+
+uint8_t IRSensor::getBadPixelCount()
+{
+	return this->badPixelCount;
+}
+
+/* Replace defective pixels with their neighbour mean from the current map */
+void IRSensor::correctBadPixels(float* map)
+{
+	for (uint8_t i = 0; i < badPixelCount; i++)
+	{
+		const bad_pixel_patch_t* patch = &badPixelPatches[i];
+		map[patch->pixel] = map[patch->neighbors[0]] * patch->weights[0] + map[patch->neighbors[1]] * patch->weights[1]
+			+ map[patch->neighbors[2]] * patch->weights[2] + map[patch->neighbors[3]] * patch->weights[3];
+	}
+}
+
+/* Pixels updated by each (readout mode, subpage) pair, so the kernels only visit the 384 new pixels */
+void IRSensor::buildSubPageTables()
+{
+	uint16_t count[2][2] = { { 0, 0 }, { 0, 0 } };
+
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		const uint8_t ilPattern = (i / 32) & 1;
+		const uint8_t chessPattern = ilPattern ^ (i & 1);
+		subPagePixels[MLX90640_INTERLEAVED][ilPattern][count[MLX90640_INTERLEAVED][ilPattern]++] = i;
+		subPagePixels[MLX90640_CHESS][chessPattern][count[MLX90640_CHESS][chessPattern]++] = i;
+	}
+}
+
+/* Burst reads for each (readout mode, subpage): the rows holding its pixels plus Ta, Vdd, gain and its CP.
+   Gaps up to FRAME_BURST_MERGE_GAP words are read through, cheaper than another address phase. */
+void IRSensor::buildReadoutPlan()
+{
+	for (uint8_t mode = 0; mode < 2; mode++)
+	{
+		for (uint8_t sp = 0; sp < 2; sp++)
+		{
+			frame_burst_t* plan = readoutPlan[mode][sp];
+			uint8_t size = 0;
+
+			for (uint16_t w = 0; w < 832; w++)
+			{
+				bool needed;
+				if (w < 768)
+				{
+					const uint8_t ilPattern = (w / 32) & 1;
+					needed = (mode == MLX90640_CHESS) ? ((ilPattern ^ (w & 1)) == sp) : (ilPattern == sp);
+				}
+				else
+				{
+					needed = (w == 768 || w == 778 || w == 800 || w == 810 || w == ((sp == 0) ? 776 : 808));
+				}
+
+				if (!needed)
+				{
+					continue;
+				}
+				if (size > 0 && w - (plan[size - 1].offset + plan[size - 1].words) <= FRAME_BURST_MERGE_GAP)
+				{
+					plan[size - 1].words = w - plan[size - 1].offset + 1;
+				}
+				else if (size < FRAME_BURSTS_MAX)
+				{
+					plan[size].offset = w;
+					plan[size].words = 1;
+					size++;
+				}
+			}
+			readoutPlanSize[mode][sp] = size;
+		}
+	}
+}
+
+void IRSensor::setOffsetCacheEpsilon(const float taEpsilon, const float vddEpsilon)
+{
+	this->offsetCacheTaEps = taEpsilon;
+	this->offsetCacheVddEps = vddEpsilon;
+	this->offsetCacheValid = false;
+}
+
+uint32_t IRSensor::getOffsetCacheRebuilds()
+{
+	return this->offsetCacheRebuilds;
+}
+
+uint32_t IRSensor::getOffsetCacheHits()
+{
+	return this->offsetCacheHits;
+}
+
+/* Ta/Vdd compensated offsets are rebuilt only when Ta or Vdd drifts past the configured epsilon */
+void IRSensor::updateOffsetCache()
+{
+	if (offsetCacheValid && fabsf(ta - offsetCacheTa) < offsetCacheTaEps && fabsf(vdd - offsetCacheVdd) < offsetCacheVddEps)
+	{
+		offsetCacheHits++;
+		return;
+	}
+
+	const float dTa = ta - 25;
+	const float dVdd = vdd - 3.3f;
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		pixOffset[i] = mlxParams.offset[i] * (1 + pixKta[i] * dTa) * (1 + pixKv[i] * dVdd);
+	}
+
+	offsetCacheTa = ta;
+	offsetCacheVdd = vdd;
+	offsetCacheValid = true;
+	offsetCacheRebuilds++;
+}
+
 uint16_t* IRSensor::readSerialNumber()
 {
-	mlxSerialNumber[0] = I2Cx_ReadData16(MLX90640_ADDR, MLX90640_DEVICEID1);
-	mlxSerialNumber[1] = I2Cx_ReadData16(MLX90640_ADDR, MLX90640_DEVICEID2);
-	mlxSerialNumber[2] = I2Cx_ReadData16(MLX90640_ADDR, MLX90640_DEVICEID3);
+	mlxSerialNumber[0] = bus->readData16(MLX90640_ADDR, MLX90640_DEVICEID1, I2C_BUS_PRIORITY_HIGH);
+	mlxSerialNumber[1] = bus->readData16(MLX90640_ADDR, MLX90640_DEVICEID2, I2C_BUS_PRIORITY_HIGH);
+	mlxSerialNumber[2] = bus->readData16(MLX90640_ADDR, MLX90640_DEVICEID3, I2C_BUS_PRIORITY_HIGH);
 	return mlxSerialNumber;
 }
 
 mlx90640_refreshrate_t IRSensor::readRefreshRate()
 {
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    return (mlx90640_refreshrate_t)((controlRegister1 & 0x0380) >> 7);
+    return (mlx90640_refreshrate_t)((controlRegister & 0x0380) >> 7);
 }
 
 void IRSensor::setRefreshRate(mlx90640_refreshrate_t rate)
 {
-    uint16_t value = (rate & 0x07) << 7;
-    
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    value = (controlRegister1 & 0xFC7F) | value;
-	I2Cx_WriteData16(MLX90640_ADDR, 0x800D, value);
+    const uint16_t value = (rate & 0x07) << 7;
+    writeControlRegister((controlRegister & 0xFC7F) | value);
+
+	/* nominal subpage period, refined by waitFrameReady */
+	this->framePeriodMs = 2000.0f / (1 << (rate & 0x07));
+	this->lastReadyValid = false;
 }
 
 mlx90640_resolution_t IRSensor::readADCResolution()
 {
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    return (mlx90640_resolution_t)((controlRegister1 & 0x0C00) >> 10);
+    return (mlx90640_resolution_t)((controlRegister & 0x0C00) >> 10);
 }
 
 void IRSensor::setADCResolution(mlx90640_resolution_t resolution)
 {
-    uint16_t value = (resolution & 0x03) << 10;
-    
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    value = (controlRegister1 & 0xF3FF) | value;
-	I2Cx_WriteData16(MLX90640_ADDR, 0x800D, value);
+    const uint16_t value = (resolution & 0x03) << 10;
+    writeControlRegister((controlRegister & 0xF3FF) | value);
 }
 
 mlx90640_mode_t IRSensor::readMlxMode()
 {
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    return (mlx90640_mode_t)((controlRegister1 & 0x1000) >> 12);
+    return (mlx90640_mode_t)((controlRegister & 0x1000) >> 12);
 }
 
 void IRSensor::setMlxMode(mlx90640_mode_t mode)
 {
-	const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    uint16_t value = controlRegister1;
+    uint16_t value = controlRegister;
 
 	if (mode == MLX90640_CHESS)
     {
-		value = (controlRegister1 | 0x1000);
+		value = (controlRegister | 0x1000);
     }
     else if (mode == MLX90640_INTERLEAVED)
     {
-		value = (controlRegister1 & 0xEFFF);
+		value = (controlRegister & 0xEFFF);
+    }
+
+    writeControlRegister(value);
+}
+
+/* Write-through: the shadow always holds the configuration we want, the bus is touched only on a change */
+void IRSensor::writeControlRegister(const uint16_t value)
+{
+	if (value != controlRegister)
+	{
+		bus->writeData16(MLX90640_ADDR, 0x800D, value, I2C_BUS_PRIORITY_HIGH);
+		this->controlRegister = value;
+	}
+}
+
+/* Compare the sensor against the shadow, a sensor that lost its configuration (brown-out, bus error) gets it back */
+void IRSensor::revalidateControlRegister()
+{
+	const uint16_t value = bus->readData16(MLX90640_ADDR, 0x800D, I2C_BUS_PRIORITY_HIGH);
+	if (value != controlRegister)
+	{
+		bus->writeData16(MLX90640_ADDR, 0x800D, controlRegister, I2C_BUS_PRIORITY_HIGH);
+		controlRestores++;
+	}
+	controlRegisterStale = false;
+	controlCheckTick = xTaskGetTickCount();
+	lastBusFaults = bus->getTelemetry().faults;
+}
+
+uint32_t IRSensor::getControlRestores()
+{
+	return this->controlRestores;
+}
+
+/* Subpages announced by the sensor that could not be read, the maps kept their previous content */
+uint32_t IRSensor::getDroppedFrames()
+{
+	return this->droppedFrames;
+}
+
+/* Waits for frame bursts beyond FRAME_BURST_TIMEOUT_MS, the bus task was held up past its retry budget */
+uint32_t IRSensor::getBurstStalls()
+{
+	return this->burstStalls;
+}
+
+bool IRSensor::isFrameReady()
+{
+    uint16_t statusRegister = bus->readData16(MLX90640_ADDR, 0x8000, I2C_BUS_PRIORITY_HIGH);
+    return (bool)(statusRegister & 0x0008);
+}
+
+/* Sleep until shortly before the predicted subpage, then poll status in FRAME_POLL_STEP_MS steps.
+   Returns false if nothing arrived within two periods. */
+bool IRSensor::waitFrameReady()
+{
+	TickType_t expectedTick = xTaskGetTickCount();
+	if (subPageLeftOver)
+	{
+		/* the flag still belongs to a subpage acquireFrame did not take: no ready edge to learn the
+		   period from, the prediction just moves on to the last edge passed */
+		subPageLeftOver = false;
+		if (lastReadyValid)
+		{
+			const uint32_t periods = (uint32_t)((float)(xTaskGetTickCount() - lastReadyTick) / framePeriodMs);
+			lastReadyTick += (TickType_t)(periods * framePeriodMs + 0.5f);
+		}
+		framePolls++;
+		if (isFrameReady())
+		{
+			return true;
+		}
+	}
+	if (lastReadyValid)
+	{
+		expectedTick = lastReadyTick + (TickType_t)(framePeriodMs + 0.5f);
+		const int32_t sleepMs = (int32_t)(expectedTick - xTaskGetTickCount()) - FRAME_WAKE_GUARD_MS;
+		if (sleepMs > 0)
+		{
+			vTaskDelay(pdMS_TO_TICKS(sleepMs));
+		}
+	}
+
+	const TickType_t deadline = xTaskGetTickCount() + (TickType_t)(2 * framePeriodMs);
+	bool missed = false;
+	TickType_t notReadyTick = 0;
+	for (;;)
+	{
+		framePolls++;
+		if (isFrameReady())
+		{
+			break;
+		}
+		missed = true;
+		notReadyTick = xTaskGetTickCount();
+		if ((int32_t)(notReadyTick - deadline) >= 0)
+		{
+			lastReadyValid = false;
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(FRAME_POLL_STEP_MS));
+	}
+
+	const TickType_t readyTick = xTaskGetTickCount();
+	if (missed)
+	{
+		/* ready time is bracketed by the last two polls, learn the period from it */
+		if (lastReadyValid)
+		{
+			const float observed = (float)(readyTick - lastReadyTick);
+			if (observed > 0.5f * framePeriodMs && observed < 1.5f * framePeriodMs)
+			{
+				framePeriodMs += (observed - framePeriodMs) * FRAME_PERIOD_GAIN;
+			}
+		}
+		framesLatenessMs += readyTick - notReadyTick;
+	}
+	else
+	{
+		/* already ready on wake-up: the estimate is late, pull it in */
+		if (lastReadyValid)
+		{
+			framePeriodMs -= FRAME_PERIOD_SHRINK_MS;
+		}
+		framesLatenessMs += ((int32_t)(readyTick - expectedTick) > 0) ? readyTick - expectedTick : 0;
+	}
+
+	frameWaits++;
+	lastReadyTick = readyTick;
+	lastReadyValid = true;
+	return true;
+}
+
+float IRSensor::getFramePeriod()
+{
+	return this->framePeriodMs;
+}
+
+float IRSensor::getPollsPerFrame()
+{
+	if (frameWaits == 0)
+	{
+		return 0;
+	}
+	return (float)framePolls / frameWaits;
+}
+
+float IRSensor::getAvgLateness()
+{
+	if (frameWaits == 0)
+	{
+		return 0;
+	}
+	return (float)framesLatenessMs / frameWaits;
+}
+
+uint8_t IRSensor::IsPixelBad(uint16_t index)
+{
+    return (badPixelMap[index >> 5] >> (index & 31)) & 1;
+}
+
+uint8_t IRSensor::CheckAdjacentPixels(uint16_t pix1, uint16_t pix2)
+{
+	const int16_t pixPosDif = pix1 - pix2;
+     if(pixPosDif > -34 && pixPosDif < -30)
+     {
+         return 1;
+     } 
+     if(pixPosDif > -2 && pixPosDif < 2)
+     {
+         return 1;
+     } 
+     if(pixPosDif > 30 && pixPosDif < 34)
+     {
+         return 1;
+     }
+     
+     return 0;  
+}
+
+/* Single-task path: read and process in the caller, into the first pool buffer.
+   Returns true when a new subpage was read and processed. Not to be mixed with acquireFrame/processFrame. */
+bool IRSensor::readImage(float emissivity)
+{
+	raw_frame_t* raw = &rawFrames[0];
+	if (!readSubPage(raw))
+	{
+		return false;
+	}
+	processSubPage(raw, emissivity);
+	return true;
+}
+
+/* Acquisition task: reads the announced subpage into a free pool buffer and hands it to processFrame.
+   Returns false when nothing was read, a subpage left unread shows up later as a skip. */
+bool IRSensor::acquireFrame()
+{
+	raw_frame_t* raw = NULL;
+	if (xQueueReceive(freeFrames, &raw, pdMS_TO_TICKS((uint32_t)framePeriodMs)) != pdPASS)
+	{
+		subPageLeftOver = true;
+		return false; //compute is behind, the sensor keeps the subpage until the next one
+	}
+	if (!readSubPage(raw))
+	{
+		subPageLeftOver = true;
+		xQueueSendToBack(freeFrames, &raw, 0);
+		return false;
+	}
+	xQueueSendToBack(readyFrames, &raw, 0);
+	return true;
+}
+
+/* Compute task: processes the oldest acquired subpage, the I2C read of the next one runs meanwhile */
+bool IRSensor::processFrame(const float emissivity, const TickType_t timeout)
+{
+	raw_frame_t* raw = NULL;
+	if (xQueueReceive(readyFrames, &raw, timeout) != pdPASS)
+	{
+		return false;
+	}
+	processSubPage(raw, emissivity);
+	xQueueSendToBack(freeFrames, &raw, 0);
+	return true;
+}
+
+bool IRSensor::readSubPage(raw_frame_t* raw)
+{
+    uint16_t statusRegister = 0;
+	const uint32_t startCycles = DWT->CYCCNT;
+
+    statusRegister = bus->readData16(MLX90640_ADDR, 0x8000, I2C_BUS_PRIORITY_HIGH);
+    if ((statusRegister & 0x0008) == 0)
+    {
+	    return false; //exit if data not ready
+    }
+    raw->readTick = xTaskGetTickCount();
+
+    /* any bus fault since the last check may have come with a sensor reset */
+    if (controlRegisterStale || bus->getTelemetry().faults != lastBusFaults ||
+        (xTaskGetTickCount() - controlCheckTick) >= pdMS_TO_TICKS(CONTROL_REVALIDATE_MS))
+    {
+	    revalidateControlRegister();
+    }
+    const uint8_t subPage = statusRegister & 0x0001;
+
+    /* only the words this subpage updated are fetched, the whole plan is queued at once
+       so low-priority bus clients get their turn after the last burst */
+    const mlx90640_mode_t mode = (mlx90640_mode_t)((controlRegister & 0x1000) >> 12);
+    const frame_burst_t* plan = readoutPlan[mode][subPage];
+    const uint8_t bursts = readoutPlanSize[mode][subPage];
+    const uint32_t generation = readGeneration + 1;
+    readGeneration = generation;
+    readTask = xTaskGetCurrentTaskHandle();
+    readError = false;
+    ulTaskNotifyTake(pdTRUE, 0);
+    uint32_t bytes = 0;
+    uint8_t queued = 0;
+    for (; queued < bursts; queued++)
+    {
+	    i2c_bus_xfer_t xfer;
+	    xfer.op = I2C_BUS_READ16_DMA;
+	    xfer.addr = MLX90640_ADDR;
+	    xfer.reg = 0x0400 + plan[queued].offset;
+	    xfer.data = raw->data + plan[queued].offset;
+	    xfer.length = plan[queued].words * 2;
+	    burstContexts[queued].sensor = this;
+	    burstContexts[queued].generation = generation;
+	    xfer.callback = frameBurstComplete;
+	    xfer.context = &burstContexts[queued];
+	    if (!bus->submit(xfer, I2C_BUS_PRIORITY_HIGH))
+	    {
+		    readError = true;
+		    break;
+	    }
+	    bytes += plan[queued].words * 2 + FRAME_BURST_OVERHEAD;
     }
+    /* the bus completes every queued burst, failed ones after their retries. Until then DMA may
+       still write into raw, so a late burst only counts as a stall and the wait goes on */
+    uint8_t completed = 0;
+    while (completed < queued)
+    {
+	    const uint32_t notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FRAME_BURST_TIMEOUT_MS));
+	    if (notified == 0)
+	    {
+		    burstStalls++;
+		    readError = true;
+		    continue;
+	    }
+	    completed += notified;
+    }
+    readTask = NULL;
+    if (readError)
+    {
+	    controlRegisterStale = true;
+	    droppedFrames++;
+	    return false;
+    }
+    this->frameBytes = bytes;
+
+    bus->writeData16(MLX90640_ADDR, 0x8000, statusRegister & 0xFFF7, I2C_BUS_PRIORITY_HIGH); //Clear bit “New data available in RAM” - Bit3 in 0x8000
+
+    raw->control = controlRegister;
+    raw->subPage = subPage;
+    raw->readCycles = DWT->CYCCNT - startCycles;
+    return true;
+}
+
+void IRSensor::processSubPage(const raw_frame_t* raw, const float emissivity)
+{
+    const float SUPPLY_VOLTAGE = 3.3f;
+	const uint32_t calcStartCycles = DWT->CYCCNT;
+
+    this->frameData = raw->data;
+    this->frameControl = raw->control;
+    this->subPage = raw->subPage;
+
+    /* Vdd */
+    float _vdd = frameWord(frameData[810]);
+    const int resolutionRAM = (frameControl & 0x0C00) >> 10;
+    const float resolutionCorrection = ldexpf(1.0f, mlxParams.resolutionEE - resolutionRAM);
+    _vdd = (resolutionCorrection * _vdd - mlxParams.vdd25) / mlxParams.kVdd + SUPPLY_VOLTAGE;
+    this->vdd = _vdd;
+
+    float ptat = frameWord(frameData[800]);
+
+    float ptatArt = frameWord(frameData[768]);
+    ptatArt = (ptat / (ptat * mlxParams.alphaPTAT + ptatArt)) * 262144.0f;
+
+    float _ta = (ptatArt / (1 + mlxParams.KvPTAT * (vdd - SUPPLY_VOLTAGE)) - mlxParams.vPTAT25);
+    _ta = _ta / mlxParams.KtPTAT + 25;
+    this->ta = _ta;
+
+    float tr = this->ta - OPENAIR_TA_SHIFT;
+
+	updateOffsetCache();
+
+	/* a mode switch keeps showing the old map until both subpages were produced in the new one */
+	const ir_process_mode_t processMode = this->processMode;
+	if (processMode != lastProcessMode)
+	{
+		lastProcessMode = processMode;
+		processedSubPages = 0;
+		subPageStats[0].count = 0;
+		subPageStats[1].count = 0;
+		subPageImageStats[0].count = 0;
+		subPageImageStats[1].count = 0;
+		pairPending = false;
+	}
+
+	const bool frameComplete = trackSubPage(raw->readTick);
+
+	if (processMode == IR_PROCESS_PREVIEW)
+	{
+		calculateImageMap(emissivity, tr);
+	}
+	else
+	{
+		calculateTempMap(emissivity, tr);
+	}
+
+	processedSubPages |= 1 << subPage;
+	if (processedSubPages == 0x03)
+	{
+		displayMode = processMode;
+	}
+	if (frameComplete)
+	{
+		publishFrame();
+	}
+
+	calcCycles = DWT->CYCCNT - calcStartCycles;
+	readImageCycles = raw->readCycles + calcCycles;
+	if (calcCycles > calcCyclesMax)
+	{
+		calcCyclesMax = calcCycles;
+	}
+}
+
+/* Pairs consecutive subpages into frames. The sensor alternates subpages, so the same one twice
+   means an odd number was lost (none if it came back within 1.5 periods), and the other one after
+   more than 2.5 periods means an even number was lost. Either way the half-frame held so far is stale:
+   it is dropped and this subpage starts a new pair. Returns true when this subpage completed a frame. */
+bool IRSensor::trackSubPage(const TickType_t readTick)
+{
+	bool inSequence = true;
+	if (subPageValid)
+	{
+		const float periods = (float)(readTick - lastSubPageTick) / framePeriodMs;
+		if (subPage == lastSubPage)
+		{
+			subPageRepeats++;
+			if (periods > 1.5f)
+			{
+				subPageSkips += 2 * (uint32_t)((periods - 2.0f) / 2.0f + 0.5f) + 1;
+			}
+			inSequence = false;
+		}
+		else if (periods > 2.5f)
+		{
+			subPageSkips += 2 * (uint32_t)((periods - 1.0f) / 2.0f + 0.5f);
+			inSequence = false;
+		}
+		if (!inSequence && pairPending)
+		{
+			resyncs++;
+			pairPending = false;
+		}
+	}
+
+	if (inSequence && pairPending)
+	{
+		frameInfo.sequence++;
+		frameInfo.firstTick = lastSubPageTick;
+		frameInfo.lastTick = readTick;
+		frameInfo.firstSubPage = lastSubPage;
+		pairPending = false;
+	}
+	else
+	{
+		pairPending = true;
+	}
+	subPageValid = true;
+	lastSubPage = subPage;
+	lastSubPageTick = readTick;
+	return !pairPending;
+}
+
+/* Snapshot of the map and its stats for the display, both subpages come from the same pair */
+void IRSensor::publishFrame()
+{
+	thermal_frame_t* frame = frames.writeBuffer();
+	frame->info = frameInfo;
+	frame->preview = (displayMode == IR_PROCESS_PREVIEW);
+	memcpy(frame->map, frame->preview ? irImage : dots, sizeof(frame->map));
+	frame->rangeMin = frame->preview ? imageStats.min : minTemp + minTempCorr;
+	frame->rangeMax = frame->preview ? imageStats.max : maxTemp + maxTempCorr;
+	frame->minTemp = minTemp;
+	frame->maxTemp = maxTemp;
+	frame->coldDotIndex = coldDotIndex;
+	frame->hotDotIndex = hotDotIndex;
+	frame->params = frameParams;
+	frame->params.lut = NULL; /* the table keeps changing, spot solves are exact */
+	frame->vdd = vdd;
+	frame->ta = ta;
+	frames.publish();
+}
+
+/* Display task only: the latest complete frame, valid until the next call */
+const thermal_frame_t* IRSensor::getLatestFrame()
+{
+	return frames.latest();
+}
+
+const ir_frame_info_t& IRSensor::getFrameInfo()
+{
+	return this->frameInfo;
+}
+
+uint32_t IRSensor::getSubPageRepeats()
+{
+	return this->subPageRepeats;
+}
+
+uint32_t IRSensor::getSubPageSkips()
+{
+	return this->subPageSkips;
+}
+
+uint32_t IRSensor::getResyncs()
+{
+	return this->resyncs;
+}
+
+/* Runs in the bus task once per frame burst, completions of an earlier read are ignored */
+void IRSensor::frameBurstComplete(void* context, const bool ok)
+{
+	const frame_burst_context_t* burst = (const frame_burst_context_t*)context;
+	IRSensor* sensor = burst->sensor;
+	const TaskHandle_t task = sensor->readTask;
+	if (task == NULL || burst->generation != sensor->readGeneration)
+	{
+		return;
+	}
+	if (!ok)
+	{
+		sensor->readError = true;
+	}
+	xTaskNotifyGive(task);
+}
 
-    I2Cx_WriteData16(MLX90640_ADDR, 0x800D, value);
+uint32_t IRSensor::getBytesPerFrame()
+{
+	return this->frameBytes;
 }
 
-bool IRSensor::isFrameReady()
+uint32_t IRSensor::getReadImageCycles()
 {
-    uint16_t statusRegister = I2Cx_ReadData16(MLX90640_ADDR, 0x8000);
-    return (bool)(statusRegister & 0x0008);
+	return this->readImageCycles;
 }
 
-uint8_t IRSensor::IsPixelBad(uint16_t index)
+uint32_t IRSensor::getCalcCycles()
 {
-    for(uint8_t i = 0; i < 5; i++)
-    {
-        if(index == mlxParams.outlierPixels[i] || index == mlxParams.brokenPixels[i])
-        {
-            return 1;
-        }    
-    }   
-    
-    return 0;
+	return this->calcCycles;
 }
 
-uint8_t IRSensor::CheckAdjacentPixels(uint16_t pix1, uint16_t pix2)
+uint32_t IRSensor::getCalcCyclesMax()
 {
-	const int16_t pixPosDif = pix1 - pix2;
-     if(pixPosDif > -34 && pixPosDif < -30)
-     {
-         return 1;
-     } 
-     if(pixPosDif > -2 && pixPosDif < 2)
-     {
-         return 1;
-     } 
-     if(pixPosDif > 30 && pixPosDif < 34)
-     {
-         return 1;
-     }
-     
-     return 0;  
+	return this->calcCyclesMax;
 }
 
-void IRSensor::readImage(float emissivity)
+void IRSensor::setToSolverMode(const to_solver_mode_t mode)
 {
-    const float SUPPLY_VOLTAGE = 3.3;
-	const uint8_t MAX_ATTEMPS = 5;
-    uint16_t statusRegister = 0;
-	uint16_t isReady = 1;
-	uint8_t cnt = 0;
+	this->toSolverMode = mode;
+}
 
-    statusRegister = I2Cx_ReadData16(MLX90640_ADDR, 0x8000);
-    if ((statusRegister & 0x0008) == 0)
-    {
-	    return; //exit if data not ready
-    }
+to_solver_mode_t IRSensor::getToSolverMode()
+{
+	return this->toSolverMode;
+}
 
-    I2Cx_ReadBuffer16(MLX90640_ADDR, 0x0400, frameData, 832 * 2); //Read meas data
-    // I2Cx_WriteData16(MLX90640_ADDR, 0x8000, statusRegister & 0xFFF7); //Clear bit “New data available in RAM” - Bit3 in 0x8000
+#define TEMP_MAP_KERNEL_SUBPAGES(SOLVER, MODE, MATCH) \
+	{ &IRSensor::calculateTempMapKernel<SOLVER, MODE, MATCH, 0>, &IRSensor::calculateTempMapKernel<SOLVER, MODE, MATCH, 1> }
+#define TEMP_MAP_KERNEL_MODES(SOLVER) \
+	{ { TEMP_MAP_KERNEL_SUBPAGES(SOLVER, MLX90640_INTERLEAVED, false), TEMP_MAP_KERNEL_SUBPAGES(SOLVER, MLX90640_INTERLEAVED, true) }, \
+	  { TEMP_MAP_KERNEL_SUBPAGES(SOLVER, MLX90640_CHESS, false), TEMP_MAP_KERNEL_SUBPAGES(SOLVER, MLX90640_CHESS, true) } }
+
+/* [solver][readout mode][mode matches calibration][subpage] */
+const IRSensor::TempMapKernel IRSensor::tempMapKernels[4][2][2][2] = {
+	TEMP_MAP_KERNEL_MODES(TO_SOLVER_EXACT),
+	TEMP_MAP_KERNEL_MODES(TO_SOLVER_FAST),
+	TEMP_MAP_KERNEL_MODES(TO_SOLVER_TABLE),
+	TEMP_MAP_KERNEL_MODES(TO_SOLVER_LUT)
+};
+
+/* Per-subpage constants for both the To kernels and the preview path, kept for on-demand spot solves */
+void IRSensor::buildFrameParams(float emissivity, float tr)
+{
+	to_frame_params_t& frame = this->frameParams;
+	float irDataCP;
 
-    const uint16_t controlRegister1 = I2Cx_ReadData16(MLX90640_ADDR, 0x800D);
-    frameData[832] = controlRegister1;
-    frameData[833] = statusRegister & 0x0001;
+	const mlx90640_mode_t mode = (mlx90640_mode_t)((frameControl & 0x1000) >> 12);
+	const bool calibrationMatch = (mode == mlxParams.calibrationModeEE);
+    
+    float ta4 = (ta + 273.15f);
+    ta4 = ta4 * ta4;
+    ta4 = ta4 * ta4;
+    float tr4 = (tr + 273.15f);
+    tr4 = tr4 * tr4;
+    tr4 = tr4 * tr4;
+	frame.taTr = tr4 - (tr4 - ta4) / emissivity;
+	frame.emissivity = emissivity;
+	frame.alphaTaCorr = 1 + mlxParams.KsTa * (ta - 25);
+	frame.ksTo1Corr = 1 - mlxParams.ksTo[1] * 273.15f;
+    
+    frame.alphaCorrR[0] = 1 / (1 + mlxParams.ksTo[0] * 40);
+    frame.alphaCorrR[1] = 1 ;
+    frame.alphaCorrR[2] = (1 + mlxParams.ksTo[1] * mlxParams.ct[2]);
+    frame.alphaCorrR[3] = frame.alphaCorrR[2] * (1 + mlxParams.ksTo[2] * (mlxParams.ct[3] - mlxParams.ct[2]));
+    
+//------------------------- Gain calculation -----------------------------------    
+    float gain = frameWord(frameData[778]);
+    
+    frame.gain = mlxParams.gainEE / gain; 
+  
+//------------------------- CP calculation -------------------------------------    
+    irDataCP = frameWord(frameData[subPage == 0 ? 776 : 808]);
+    irDataCP = irDataCP * frame.gain;
 
-    /* Vdd */
-    float _vdd = frameData[810];
-    if(_vdd > 32767)
+    const float cpOffsetComp = (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3f));
+    if (subPage == 0)
     {
-        _vdd = _vdd - 65536;
+        irDataCP = irDataCP - mlxParams.cpOffset[0] * cpOffsetComp;
     }
-    const int resolutionRAM = (frameData[832] & 0x0C00) >> 10;
-    const float resolutionCorrection = pow(2, (double)mlxParams.resolutionEE) / pow(2, (double)resolutionRAM);
-    _vdd = (resolutionCorrection * _vdd - mlxParams.vdd25) / mlxParams.kVdd + SUPPLY_VOLTAGE;
-    this->vdd = _vdd;
-
-    float ptat = frameData[800];
-    if(ptat > 32767)
+    else if (calibrationMatch)
     {
-        ptat = ptat - 65536;
+        irDataCP = irDataCP - mlxParams.cpOffset[1] * cpOffsetComp;
     }
-
-    float ptatArt = frameData[768];
-    if(ptatArt > 32767)
+    else
     {
-        ptatArt = ptatArt - 65536;
+        irDataCP = irDataCP - (mlxParams.cpOffset[1] + mlxParams.ilChessC[0]) * cpOffsetComp;
     }
-    ptatArt = (ptat / (ptat * mlxParams.alphaPTAT + ptatArt)) * pow(2, 18.0);
+    frame.cpCorrection = mlxParams.tgc * irDataCP;
+}
 
-    float _ta = (ptatArt / (1 + mlxParams.KvPTAT * (vdd - SUPPLY_VOLTAGE)) - mlxParams.vPTAT25);
-    _ta = _ta / mlxParams.KtPTAT + 25;
-    this->ta = _ta;
+void IRSensor::calculateTempMap(float emissivity, float tr)
+{
+	const mlx90640_mode_t mode = (mlx90640_mode_t)((frameControl & 0x1000) >> 12);
+	const bool calibrationMatch = (mode == mlxParams.calibrationModeEE);
 
-    float tr = this->ta - OPENAIR_TA_SHIFT;
+	buildFrameParams(emissivity, tr);
+
+	to_solver_mode_t solver = toSolverMode;
+	if (solver == TO_SOLVER_LUT)
+	{
+		updateToLut();
+		frameParams.lut = &toLut[toLutActive];
+		/* To depends on s mostly through s + taTr, so a slightly stale table is reused by shifting s.
+		   Further away the shift error outgrows the LUT bound and the exact kernel runs until the rebuild. */
+		if (!toLutValid || fabsf(ta - frameParams.lut->ta) > TO_LUT_SHIFT_MAX || emissivity != frameParams.lut->emissivity)
+		{
+			solver = TO_SOLVER_EXACT;
+		}
+		frameParams.lutSMin = frameParams.lut->sMin - (frameParams.taTr - frameParams.lut->taTr);
+	}
 
-	calculateTempMap(emissivity, tr);
-    // calculateImageMap();
+	(this->*tempMapKernels[solver][mode][calibrationMatch][subPage])(frameParams);
+	correctBadPixels(dots);
+	mergeTempStats();
 }
 
-void IRSensor::calculateTempMap(float emissivity, float tr)
+/* To of one pixel from its gain, offset and CP corrected signal */
+template<to_solver_mode_t SOLVER>
+inline float IRSensor::solvePixelTemp(const to_frame_params_t& frame, float irData, const uint16_t pixelNumber)
 {
-	float irDataCP[2];
-	int8_t pattern;
-	float alphaCorrR[4];
     int8_t range;
 
-	const uint16_t subPage = frameData[833];
+    irData = irData / frame.emissivity;
     
-    float ta4 = (ta + 273.15f);
-    ta4 = ta4 * ta4;
-    ta4 = ta4 * ta4;
-    float tr4 = (tr + 273.15f);
-    tr4 = tr4 * tr4;
-    tr4 = tr4 * tr4;
-	const float taTr = tr4 - (tr4 - ta4) / emissivity;
-
-	const float ktaScale = pow(2, (double)mlxParams.ktaScale);
-	const float kvScale = pow(2, (double)mlxParams.kvScale);
-	const float alphaScale = pow(2, (double)mlxParams.alphaScale);
-    
-    alphaCorrR[0] = 1 / (1 + mlxParams.ksTo[0] * 40);
-    alphaCorrR[1] = 1 ;
-    alphaCorrR[2] = (1 + mlxParams.ksTo[1] * mlxParams.ct[2]);
-    alphaCorrR[3] = alphaCorrR[2] * (1 + mlxParams.ksTo[2] * (mlxParams.ct[3] - mlxParams.ct[2]));
+    const float alphaCompensated = pixAlpha[pixelNumber] * frame.alphaTaCorr;
+                
+    float Sx = alphaCompensated * alphaCompensated * alphaCompensated * (irData + alphaCompensated * frame.taTr);
+    Sx = fourthRoot<SOLVER>(Sx) * mlxParams.ksTo[1];            
     
-//------------------------- Gain calculation -----------------------------------    
-    float gain = frameData[778];
-    if(gain > 32767)
+    float To = fourthRoot<SOLVER>(irData / (alphaCompensated * frame.ksTo1Corr + Sx) + frame.taTr) - 273.15f;                     
+            
+    if(To < mlxParams.ct[1])
     {
-        gain = gain - 65536;
+        range = 0;
     }
-    
-    gain = mlxParams.gainEE / gain; 
-  
-//------------------------- To calculation -------------------------------------    
-	const uint8_t mode = (frameData[832] & 0x1000) >> 5;
-    
-    irDataCP[0] = frameData[776];  
-    irDataCP[1] = frameData[808];
-    for( int i = 0; i < 2; i++)
+    else if(To < mlxParams.ct[2])   
     {
-        if(irDataCP[i] > 32767)
-        {
-            irDataCP[i] = irDataCP[i] - 65536;
-        }
-        irDataCP[i] = irDataCP[i] * gain;
-    }
-    irDataCP[0] = irDataCP[0] - mlxParams.cpOffset[0] * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
-    if( mode ==  mlxParams.calibrationModeEE)
+        range = 1;            
+    }   
+    else if(To < mlxParams.ct[3])
     {
-        irDataCP[1] = irDataCP[1] - mlxParams.cpOffset[1] * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
+        range = 2;            
     }
     else
     {
-      irDataCP[1] = irDataCP[1] - (mlxParams.cpOffset[1] + mlxParams.ilChessC[0]) * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
-    }
+        range = 3;            
+    }      
+    
+    return fourthRoot<SOLVER>(irData / (alphaCompensated * frame.alphaCorrR[range] * (1 + mlxParams.ksTo[range] * (To - mlxParams.ct[range]))) + frame.taTr) - 273.15f;
+}
 
-    for(uint16_t pixelNumber = 0; pixelNumber < 768; pixelNumber++)
-    {
-	    const int8_t ilPattern = pixelNumber / 32 - (pixelNumber / 64) * 2;
-	    const int8_t chessPattern = ilPattern ^ (pixelNumber - (pixelNumber / 2) * 2);
-	    const int8_t conversionPattern = ((pixelNumber + 2) / 4 - (pixelNumber + 3) / 4 + (pixelNumber + 1) / 4 - pixelNumber / 4) * (1 - 2 * ilPattern);
-        
-        if(mode == 0)
-        {
-          pattern = ilPattern; 
-        }
-        else 
-        {
-          pattern = chessPattern; 
-        }               
-        
-        if(pattern == frameData[833])
-        {    
-            float irData = frameData[pixelNumber];
-            if(irData > 32767)
-            {
-                irData = irData - 65536;
-            }
-            irData = irData * gain;
+/* Index and lerp into the active To(s) table, exact solve outside of it */
+template<>
+inline float IRSensor::solvePixelTemp<TO_SOLVER_LUT>(const to_frame_params_t& frame, float irData, const uint16_t pixelNumber)
+{
+    const to_lut_t* lut = frame.lut;
+    const float pos = (irData / (frame.emissivity * pixAlpha[pixelNumber] * frame.alphaTaCorr) - frame.lutSMin) * lut->sScale;
 
-            const float kta = mlxParams.kta[pixelNumber] / ktaScale;
-            const float kv = mlxParams.kv[pixelNumber] / kvScale;
-            irData = irData - mlxParams.offset[pixelNumber]*(1 + kta*(ta - 25))*(1 + kv*(vdd - 3.3));
-            
-            if(mode !=  mlxParams.calibrationModeEE)
-            {
-              irData = irData + mlxParams.ilChessC[2] * (2 * ilPattern - 1) - mlxParams.ilChessC[1] * conversionPattern; 
-            }                       
-    
-            irData = irData - mlxParams.tgc * irDataCP[subPage];
-            irData = irData / emissivity;
-            
-            float alphaCompensated = SCALEALPHA * alphaScale / mlxParams.alpha[pixelNumber];
-            alphaCompensated = alphaCompensated*(1 + mlxParams.KsTa * (ta - 25));
-                        
-            float Sx = alphaCompensated * alphaCompensated * alphaCompensated * (irData + alphaCompensated * taTr);
-            Sx = sqrt(sqrt(Sx)) * mlxParams.ksTo[1];            
-            
-            float To = sqrt(sqrt(irData / (alphaCompensated * (1 - mlxParams.ksTo[1] * 273.15) + Sx) + taTr)) - 273.15;                     
-                    
-            if(To < mlxParams.ct[1])
-            {
-                range = 0;
-            }
-            else if(To < mlxParams.ct[2])   
-            {
-                range = 1;            
-            }   
-            else if(To < mlxParams.ct[3])
-            {
-                range = 2;            
-            }
-            else
-            {
-                range = 3;            
-            }      
-            
-            To = sqrt(sqrt(irData / (alphaCompensated * alphaCorrR[range] * (1 + mlxParams.ksTo[range] * (To - mlxParams.ct[range]))) + taTr)) - 273.15;
-                        
-            dots[pixelNumber] = To;
-        }
+    if(pos >= 0 && pos < TO_LUT_SIZE - 1)
+    {
+        const uint16_t index = (uint16_t)pos;
+        const float frac = pos - index;
+        return lut->to[index] + (lut->to[index + 1] - lut->to[index]) * frac;
     }
+    return solvePixelTemp<TO_SOLVER_EXACT>(frame, irData, pixelNumber);
 }
 
-void IRSensor::calculateImageMap()
+/* Same To equation with alpha folded into s, used to fill the LUT */
+float IRSensor::solveNormalizedTemp(const to_frame_params_t& frame, const float s)
 {
-	float irDataCP[2];
-    float irData;
-    float alphaCompensated;
-	int8_t ilPattern;
-    int8_t chessPattern;
-    int8_t pattern;
-    int8_t conversionPattern;
-    float image;
-    float kta;
-    float kv;
-    
-    uint16_t subPage = frameData[833];
-    
-    float ktaScale = pow(2, (double)mlxParams.ktaScale);
-    float kvScale = pow(2, (double)mlxParams.kvScale);
-    
-//------------------------- Gain calculation -----------------------------------    
-    float gain = frameData[778];
-    if(gain > 32767)
+    int8_t range;
+
+    const float Sx = sqrtf(sqrtf(s + frame.taTr)) * mlxParams.ksTo[1];
+    const float To = sqrtf(sqrtf(s / (frame.ksTo1Corr + Sx) + frame.taTr)) - 273.15f;
+
+    if(To < mlxParams.ct[1])
     {
-        gain = gain - 65536;
+        range = 0;
     }
-    
-    gain = mlxParams.gainEE / gain; 
-  
-//------------------------- Image calculation -------------------------------------    
-    uint8_t mode = (frameData[832] & 0x1000) >> 5;
-    
-    irDataCP[0] = frameData[776];  
-    irDataCP[1] = frameData[808];
-    for( int i = 0; i < 2; i++)
+    else if(To < mlxParams.ct[2])
     {
-        if(irDataCP[i] > 32767)
-        {
-            irDataCP[i] = irDataCP[i] - 65536;
-        }
-        irDataCP[i] = irDataCP[i] * gain;
+        range = 1;
     }
-    irDataCP[0] = irDataCP[0] - mlxParams.cpOffset[0] * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
-    if( mode == mlxParams.calibrationModeEE)
+    else if(To < mlxParams.ct[3])
     {
-        irDataCP[1] = irDataCP[1] - mlxParams.cpOffset[1] * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
+        range = 2;
     }
     else
     {
-      irDataCP[1] = irDataCP[1] - (mlxParams.cpOffset[1] + mlxParams.ilChessC[0]) * (1 + mlxParams.cpKta * (ta - 25)) * (1 + mlxParams.cpKv * (vdd - 3.3));
+        range = 3;
     }
 
-    for( int pixelNumber = 0; pixelNumber < 768; pixelNumber++)
+    return sqrtf(sqrtf(s / (frame.alphaCorrR[range] * (1 + mlxParams.ksTo[range] * (To - mlxParams.ct[range]))) + frame.taTr)) - 273.15f;
+}
+
+/* Rebuild the shadow To(s) table in TO_LUT_REBUILD_CHUNK steps per subpage and swap it in when complete */
+void IRSensor::updateToLut()
+{
+	to_lut_t* shadow = &toLut[toLutActive ^ 1];
+
+	if (toLutBuildPos < 0)
+	{
+		const to_lut_t* active = &toLut[toLutActive];
+		if (toLutValid && fabsf(ta - active->ta) < TO_LUT_TA_EPS && frameParams.emissivity == active->emissivity)
+		{
+			return;
+		}
+
+		float toMin4 = TO_LUT_TO_MIN + 273.15f;
+		toMin4 = toMin4 * toMin4;
+		toMin4 = toMin4 * toMin4;
+		float toMax4 = TO_LUT_TO_MAX + 273.15f;
+		toMax4 = toMax4 * toMax4;
+		toMax4 = toMax4 * toMax4;
+
+		toLutFrame = frameParams;
+		shadow->ta = ta;
+		shadow->taTr = frameParams.taTr;
+		shadow->emissivity = frameParams.emissivity;
+		shadow->sMin = toMin4 - frameParams.taTr;
+		shadow->sScale = (TO_LUT_SIZE - 1) / (toMax4 - toMin4);
+		toLutBuildPos = 0;
+	}
+
+	const float sStep = 1 / shadow->sScale;
+	int16_t end = toLutBuildPos + TO_LUT_REBUILD_CHUNK;
+	if (end > TO_LUT_SIZE)
+	{
+		end = TO_LUT_SIZE;
+	}
+	for (int16_t i = toLutBuildPos; i < end; i++)
+	{
+		shadow->to[i] = solveNormalizedTemp(toLutFrame, shadow->sMin + i * sStep);
+	}
+	toLutBuildPos = end;
+
+	if (toLutBuildPos >= TO_LUT_SIZE)
+	{
+		toLutActive ^= 1;
+		toLutValid = true;
+		toLutBuildPos = -1;
+	}
+}
+
+
+/* Per-pixel To solve, specialized so the loop carries no readout mode or subpage branches */
+template<to_solver_mode_t SOLVER, mlx90640_mode_t MODE, bool CALIB_MATCH, uint8_t SUBPAGE>
+void IRSensor::calculateTempMapKernel(const to_frame_params_t& frame)
+{
+    const uint16_t* pixels = subPagePixels[MODE][SUBPAGE];
+
+    temp_stats_t* stats = &subPageStats[SUBPAGE];
+    float minTo = 1000;
+    float maxTo = -100;
+    float sumTo = 0;
+    uint16_t minIndex = pixels[0];
+    uint16_t maxIndex = pixels[0];
+    uint16_t count = 0;
+    memset(stats->hist, 0, sizeof(stats->hist));
+
+    for(uint16_t i = 0; i < 768 / 2; i++)
     {
-        ilPattern = pixelNumber / 32 - (pixelNumber / 64) * 2; 
-        chessPattern = ilPattern ^ (pixelNumber - (pixelNumber/2)*2); 
-        conversionPattern = ((pixelNumber + 2) / 4 - (pixelNumber + 3) / 4 + (pixelNumber + 1) / 4 - pixelNumber / 4) * (1 - 2 * ilPattern);
+        const uint16_t pixelNumber = pixels[i];
+        float irData = frameWord(frameData[pixelNumber]);
+        irData = irData * frame.gain;
+
+        irData = irData - pixOffset[pixelNumber];
         
-        if(mode == 0)
+        if(!CALIB_MATCH)
+        {
+          irData = irData + pixIlChessCorr[pixelNumber];
+        }                       
+
+        irData = irData - frame.cpCorrection;
+
+        const float To = solvePixelTemp<SOLVER>(frame, irData, pixelNumber);
+                    
+        dots[pixelNumber] = To;
+
+        if(IsPixelBad(pixelNumber))
+        {
+            continue;
+        }
+        count++;
+
+        if(To < minTo)
+        {
+            minTo = To;
+            minIndex = pixelNumber;
+        }
+        if(To > maxTo)
+        {
+            maxTo = To;
+            maxIndex = pixelNumber;
+        }
+        sumTo = sumTo + To;
+
+        const float bin = (To - TEMP_HIST_MIN) * (1.0f / TEMP_HIST_BIN_WIDTH);
+        if(bin <= 0)
+        {
+            stats->hist[0]++;
+        }
+        else if(bin >= TEMP_HIST_BINS - 1)
+        {
+            stats->hist[TEMP_HIST_BINS - 1]++;
+        }
+        else
         {
-          pattern = ilPattern; 
+            stats->hist[(uint8_t)bin]++;
         }
-        else 
+    }
+
+    stats->min = minTo;
+    stats->max = maxTo;
+    stats->sum = sumTo;
+    stats->minIndex = minIndex;
+    stats->maxIndex = maxIndex;
+    stats->count = count;
+}
+
+/* Combine two subpage stats, cost does not depend on the pixel count */
+static void mergeStats(const temp_stats_t* sp0, const temp_stats_t* sp1, temp_stats_t* out)
+{
+	if (sp0->count == 0 || sp1->count == 0)
+	{
+		*out = (sp0->count != 0) ? *sp0 : *sp1;
+		return;
+	}
+
+	const bool minFrom0 = (sp0->min < sp1->min) || (sp0->min == sp1->min && sp0->minIndex < sp1->minIndex);
+	const bool maxFrom0 = (sp0->max > sp1->max) || (sp0->max == sp1->max && sp0->maxIndex < sp1->maxIndex);
+	out->min = minFrom0 ? sp0->min : sp1->min;
+	out->minIndex = minFrom0 ? sp0->minIndex : sp1->minIndex;
+	out->max = maxFrom0 ? sp0->max : sp1->max;
+	out->maxIndex = maxFrom0 ? sp0->maxIndex : sp1->maxIndex;
+	out->sum = sp0->sum + sp1->sum;
+	out->count = sp0->count + sp1->count;
+	for (uint8_t i = 0; i < TEMP_HIST_BINS; i++)
+	{
+		out->hist[i] = sp0->hist[i] + sp1->hist[i];
+	}
+}
+
+void IRSensor::mergeTempStats()
+{
+	mergeStats(&subPageStats[0], &subPageStats[1], &frameStats);
+
+	this->minTemp = frameStats.min;
+	this->maxTemp = frameStats.max;
+	this->coldDotIndex = frameStats.minIndex;
+	this->hotDotIndex = frameStats.maxIndex;
+}
+
+/* Preview path: gain, offset and CP corrected signal divided by alpha, no To solve */
+void IRSensor::calculateImageMap(float emissivity, float tr)
+{
+    const mlx90640_mode_t mode = (mlx90640_mode_t)((frameControl & 0x1000) >> 12);
+    const bool calibrationMatch = (mode == mlxParams.calibrationModeEE);
+
+    buildFrameParams(emissivity, tr);
+    const to_frame_params_t& frame = this->frameParams;
+
+    temp_stats_t* stats = &subPageImageStats[subPage];
+    const uint16_t* pixels = subPagePixels[mode][subPage];
+    float minImage = 0;
+    float maxImage = 0;
+    uint16_t minIndex = pixels[0];
+    uint16_t maxIndex = pixels[0];
+    uint16_t count = 0;
+    float sumImage = 0;
+
+    for(uint16_t i = 0; i < 768 / 2; i++)
+    {
+        const uint16_t pixelNumber = pixels[i];
+        float irData = frameWord(frameData[pixelNumber]);
+        irData = irData * frame.gain;
+        
+        irData = irData - pixOffset[pixelNumber];
+
+        if(!calibrationMatch)
         {
-          pattern = chessPattern; 
+          irData = irData + pixIlChessCorr[pixelNumber];
         }
         
-        if(pattern == frameData[833])
-        {    
-            irData = frameData[pixelNumber];
-            if(irData > 32767)
-            {
-                irData = irData - 65536;
-            }
-            irData = irData * gain;
-            
-            kta = mlxParams.kta[pixelNumber]/ktaScale;
-            kv = mlxParams.kv[pixelNumber]/kvScale;
-            irData = irData - mlxParams.offset[pixelNumber]*(1 + kta*(ta - 25))*(1 + kv*(vdd - 3.3));
+        irData = irData - frame.cpCorrection;
+                    
+        const float image = irData / pixAlpha[pixelNumber];
+        irImage[pixelNumber] = image;
 
-            if(mode !=  mlxParams.calibrationModeEE)
-            {
-              irData = irData + mlxParams.ilChessC[2] * (2 * ilPattern - 1) - mlxParams.ilChessC[1] * conversionPattern; 
-            }
-            
-            irData = irData - mlxParams.tgc * irDataCP[subPage];
-                        
-            alphaCompensated = mlxParams.alpha[pixelNumber];
-            
-            image = irData*alphaCompensated;
-            
-            colors[pixelNumber] = image;
+        if(IsPixelBad(pixelNumber))
+        {
+            continue;
+        }
+
+        if(count == 0 || image < minImage)
+        {
+            minImage = image;
+            minIndex = pixelNumber;
+        }
+        if(count == 0 || image > maxImage)
+        {
+            maxImage = image;
+            maxIndex = pixelNumber;
         }
+        sumImage = sumImage + image;
+        count++;
     }
+    correctBadPixels(irImage);
+
+    stats->min = minImage;
+    stats->max = maxImage;
+    stats->sum = sumImage;
+    stats->minIndex = minIndex;
+    stats->maxIndex = maxIndex;
+    stats->count = count;
+
+    mergeStats(&subPageImageStats[0], &subPageImageStats[1], &imageStats);
+
+    /* the signal is monotonic in To, so the spot readouts only need two solves */
+    this->coldDotIndex = imageStats.minIndex;
+    this->hotDotIndex = imageStats.maxIndex;
+    this->minTemp = solvePixelTemp<TO_SOLVER_EXACT>(frame, irImage[coldDotIndex] * pixAlpha[coldDotIndex], coldDotIndex);
+    this->maxTemp = solvePixelTemp<TO_SOLVER_EXACT>(frame, irImage[hotDotIndex] * pixAlpha[hotDotIndex], hotDotIndex);
 }
 
-uint16_t IRSensor::getSubPage()
+void IRSensor::setProcessMode(const ir_process_mode_t mode)
+{
+	this->processMode = mode;
+}
+
+ir_process_mode_t IRSensor::getProcessMode()
 {
-    return frameData[833];
+	return this->processMode;
 }
 
-float IRSensor::getVdd()
+/* Radiometric To of a single pixel of a published frame, solved on demand for a preview map.
+   Only the frame and the calibration tables fixed at init are read, so any task may call it. */
+float IRSensor::getPixelTemp(const thermal_frame_t* frame, const uint16_t index)
 {
-    return this->vdd;
+	if (!frame->preview)
+	{
+		return frame->map[index];
+	}
+	return solvePixelTemp<TO_SOLVER_EXACT>(frame->params, frame->map[index] * pixAlpha[index], index);
 }
 
-float IRSensor::getTa()
+/* Compute task only: the subpage processFrame handled last, other tasks read frames */
+uint16_t IRSensor::getSubPage()
 {
-    return this->ta;
+    return this->subPage;
 }
 
 float* IRSensor::getTempMap()
@@ -1036,6 +1916,20 @@ float IRSensor::getMinTemp()
 	return this->minTemp;
 }
 
+float IRSensor::getAvgTemp()
+{
+	if (frameStats.count == 0)
+	{
+		return 0;
+	}
+	return frameStats.sum / frameStats.count;
+}
+
+const uint16_t* IRSensor::getTempHistogram()
+{
+	return this->frameStats.hist;
+}
+
 uint16_t IRSensor::getHotDotIndex()
 {
 	return this->hotDotIndex;
@@ -1046,37 +1940,82 @@ uint16_t IRSensor::getColdDotIndex()
 	return this->coldDotIndex;
 }
 
-void IRSensor::drawGradient(const uint16_t startX, const uint16_t startY, const uint16_t stopX, const uint16_t stopY)
+template <>
+uint16_t IRSensor::pixelColor<uint16_t>(const float temperature, const float minTemp, const float maxTemp)
+{
+	return temperatureToRGB565(temperature, minTemp, maxTemp);
+}
+
+template <>
+uint8_t IRSensor::pixelColor<uint8_t>(const float temperature, const float minTemp, const float maxTemp)
+{
+	return temperatureToIndex(temperature, minTemp, maxTemp);
+}
+
+void IRSensor::drawGradient(const thermal_frame_t* frame, const uint16_t startX, const uint16_t startY, const uint16_t stopX, const uint16_t stopY)
+{
+	if (pixelFormat == IR_PIXEL_L8)
+	{
+		drawGradientAs<uint8_t>(frame, startX, startY, stopX, stopY);
+	}
+	else
+	{
+		drawGradientAs<uint16_t>(frame, startX, startY, stopX, stopY);
+	}
+}
+
+void IRSensor::visualizeImage(const thermal_frame_t* frame, const uint8_t scale, const uint8_t method)
+{
+	if (pixelFormat == IR_PIXEL_L8)
+	{
+		visualizeImageAs<uint8_t>(frame, scale, method);
+	}
+	else
+	{
+		visualizeImageAs<uint16_t>(frame, scale, method);
+	}
+}
+
+template <typename pixel_t>
+void IRSensor::drawGradientAs(const thermal_frame_t* frame, const uint16_t startX, const uint16_t startY, const uint16_t stopX, const uint16_t stopY)
 {
 	const uint16_t height = stopY - startY;
 	const uint16_t width = stopX - startX;
+	const float minTemp = frame->minTemp;
+	const float maxTemp = frame->maxTemp;
 	const float diff = (maxTemp + minTempCorr - minTemp + maxTempCorr) / height;
-	uint16_t line[240];
+	pixel_t line[240];
 	for (uint16_t j = 0; j < height; j++)
 	{
 		const float temp = minTemp + (diff * j);
-		line[j] = temperatureToRGB565(temp, minTemp + minTempCorr, maxTemp + maxTempCorr);	
+		line[j] = pixelColor<pixel_t>(temp, minTemp + minTempCorr, maxTemp + maxTempCorr);	
 	}
 
 	for (uint16_t i = 0; i < width; i++)
 	{
-		volatile uint16_t *pSdramAddress = (uint16_t *)(this->fb_addr + (240 * (startX + i) + startY) * 2);
+		volatile pixel_t *pSdramAddress = (pixel_t *)(this->fb_addr + (240 * (startX + i) + startY) * sizeof(pixel_t));
 		for (uint16_t j = 0; j < height; j++)
 		{
-			*(volatile uint16_t *)pSdramAddress = line[j];	
+			*(volatile pixel_t *)pSdramAddress = line[j];	
 			pSdramAddress++;
 		}
 	}
 }
 
-void IRSensor::visualizeImage(const uint8_t scale, const uint8_t method)
+template <typename pixel_t>
+void IRSensor::visualizeImageAs(const thermal_frame_t* frame, const uint8_t scale, const uint8_t method)
 {
 	uint8_t col = 0;
 	uint8_t row = 0;
 	uint16_t pixelIdx;
 	uint16_t color;
 
-	volatile uint16_t* pSdramAddress = (uint16_t *)this->fb_addr;
+	volatile pixel_t* pSdramAddress = (pixel_t *)this->fb_addr;
+
+	/* preview frames are colorized straight from the normalized IR signal */
+	const float* map = frame->map;
+	const float rangeMin = frame->rangeMin;
+	const float rangeMax = frame->rangeMax;
 
 	_isImageReady = false;
 
@@ -1084,7 +2023,7 @@ void IRSensor::visualizeImage(const uint8_t scale, const uint8_t method)
 	{
         for (uint16_t i = 0; i < 32 * 24; i++)
 		{
-			colors[i] = this->temperatureToRGB565(dots[i], minTemp + minTempCorr, maxTemp + maxTempCorr);		
+			colors[i] = this->pixelColor<pixel_t>(map[i], rangeMin, rangeMax);		
 		}
 
 		col = 32;
@@ -1097,7 +2036,7 @@ void IRSensor::visualizeImage(const uint8_t scale, const uint8_t method)
 				{
 	                pixelIdx = ((row - 1) * 32) + (col - 1);
 	                for(uint8_t j = 0; j < scale; j++) {
-		                *(volatile uint16_t *)pSdramAddress = colors[pixelIdx];
+		                *(volatile pixel_t *)pSdramAddress = (pixel_t)colors[pixelIdx];
 		                pSdramAddress++;
 	                }
 					row--;
@@ -1114,7 +2053,7 @@ void IRSensor::visualizeImage(const uint8_t scale, const uint8_t method)
 
         for (uint16_t i = 0; i < 32 * 24; i++)
 		{
-			colors[i] = this->temperatureToRGB565(dots[i], minTemp + minTempCorr, maxTemp + maxTempCorr);		
+			colors[i] = this->pixelColor<pixel_t>(map[i], rangeMin, rangeMax);		
 		}
 
         col = 32 * scale;
@@ -1144,16 +2083,16 @@ void IRSensor::visualizeImage(const uint8_t scale, const uint8_t method)
 				d3 = t * u;
 				d4 = (1 - t) * u;
 
-				p1 = dots[y * 32 + x];
-				p2 = dots[y * 32 + x + 1];
-				p3 = dots[(y + 1) * 32 + x + 1];
-				p4 = dots[(y + 1) * 32 + x];
+				p1 = map[y * 32 + x];
+				p2 = map[y * 32 + x + 1];
+				p3 = map[(y + 1) * 32 + x + 1];
+				p4 = map[(y + 1) * 32 + x];
 
 				float interp = p1*d1 + p2*d2 + p3*d3 + p4*d4;
 
 				// pixelIdx = (y * 32) + x;
 
-                *(volatile uint16_t *)pSdramAddress = this->temperatureToRGB565(interp, minTemp + minTempCorr, maxTemp + maxTempCorr);
+                *(volatile pixel_t *)pSdramAddress = this->pixelColor<pixel_t>(interp, rangeMin, rangeMax);
 	            pSdramAddress++;
 
 				row--;
@@ -1211,25 +2150,6 @@ void IRSensor::Dma2dXferCpltCallback(DMA2D_HandleTypeDef* hdma2d)
 
 }
 
-void IRSensor::findMinAndMaxTemp()
-{
-	this->minTemp = 1000;
-	this->maxTemp = -100;
-	for (uint16_t i = 0; i < 32 * 24; i++)
-	{
-		if (dots[i] < minTemp)
-		{
-			minTemp = dots[i];	
-			coldDotIndex = i;
-		}
-		if (dots[i] > maxTemp)
-		{
-			maxTemp = dots[i];
-			hotDotIndex = i;
-		}
-	}
-}
-
 uint16_t IRSensor::rgb2color(const uint8_t R, const uint8_t G, const uint8_t B)
 {
 	return ((R & 0xF8) << 8) | ((G & 0xFC) << 3) | (B >> 3);
@@ -1239,6 +2159,42 @@ uint8_t IRSensor::calculateRGB(const uint8_t rgb1, const uint8_t rgb2, const flo
 	return (uint8_t)(rgb1 + (((t - t1) / step) * (rgb2 - rgb1)));
 }
 
+/* Range position as a palette index, the CLUT holds the color scheme */
+uint8_t IRSensor::temperatureToIndex(const float temperature, const float minTemp, const float maxTemp)
+{
+	const float level = (temperature - minTemp) / (maxTemp - minTemp) * (IR_CLUT_LEVELS - 1);
+	if (!(level > 0.0f))
+	{
+		return 0;
+	}
+	if (level >= IR_CLUT_LEVELS - 1)
+	{
+		return IR_CLUT_LEVELS - 1;
+	}
+	return (uint8_t)(level + 0.5f);
+}
+
+/* The color scheme sampled at IR_CLUT_LEVELS points across the range, as LTDC CLUT entries (0x00RRGGBB).
+   The entry after the ramp is black, for buffers cleared to 0xFF. */
+void IRSensor::buildClut(uint32_t* clut)
+{
+	const uint16_t colorSchemeSize = sizeof(DEFAULT_COLOR_SCHEME)/3;
+	const float step = (IR_CLUT_LEVELS - 1) / (float)(colorSchemeSize - 1);
+	for (uint16_t i = 0; i < IR_CLUT_LEVELS; i++)
+	{
+		const uint8_t step1 = (i < IR_CLUT_LEVELS - 1) ? (uint8_t)(i / step) : colorSchemeSize - 2;
+		const uint8_t step2 = step1 + 1;
+		const uint8_t red = calculateRGB(colorScheme[step1 * 3 + 0], colorScheme[step2 * 3 + 0], step1 * step, step, i);
+		const uint8_t green = calculateRGB(colorScheme[step1 * 3 + 1], colorScheme[step2 * 3 + 1], step1 * step, step, i);
+		const uint8_t blue = calculateRGB(colorScheme[step1 * 3 + 2], colorScheme[step2 * 3 + 2], step1 * step, step, i);
+		clut[i] = ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue;
+	}
+	for (uint16_t i = IR_CLUT_LEVELS; i < 256; i++)
+	{
+		clut[i] = 0;
+	}
+}
+
 uint16_t IRSensor::temperatureToRGB565(const float temperature, const float minTemp, const float maxTemp) {
 	uint16_t val;
 	if (temperature < minTemp) {
@@ -1249,7 +2205,7 @@ uint16_t IRSensor::temperatureToRGB565(const float temperature, const float minT
 		val = rgb2color(colorScheme[(colorSchemeSize - 1) * 3 + 0], colorScheme[(colorSchemeSize - 1) * 3 + 1], colorScheme[(colorSchemeSize - 1) * 3 + 2]);
 	}
 	else {
-		const float step = (maxTemp - minTemp) / 10.0;
+		const float step = (maxTemp - minTemp) / 10.0f;
 		const uint8_t step1 = (uint8_t)((temperature - minTemp) / step);
 		const uint8_t step2 = step1 + 1;
 		const uint8_t red = calculateRGB(colorScheme[step1 * 3 + 0], colorScheme[step2 * 3 + 0], (minTemp + step1 * step), step, temperature);
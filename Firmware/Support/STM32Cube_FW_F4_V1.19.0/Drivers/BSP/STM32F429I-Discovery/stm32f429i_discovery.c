@@ -113,6 +113,7 @@ static uint8_t Is_LCD_IO_Initialized = 0;
   */ 
 /* I2Cx bus function */
 static void               I2Cx_Error(void);
+static void               I2Cx_BitDelay(void);
 static void               I2Cx_MspInit(I2C_HandleTypeDef *hi2c);  
 #ifdef EE_M24LR64
 static HAL_StatusTypeDef  I2Cx_WriteBufferDMA(uint8_t Addr, uint16_t Reg,  uint8_t *pBuffer, uint16_t Length);
@@ -291,13 +292,13 @@ uint32_t BSP_PB_GetState(Button_TypeDef Button)
 static void I2Cx_MspInit(I2C_HandleTypeDef *hi2c)
 {
   GPIO_InitTypeDef  GPIO_InitStruct;  
+  static DMA_HandleTypeDef hdma_rx;
 #ifdef EE_M24LR64
   static DMA_HandleTypeDef hdma_tx;
-  static DMA_HandleTypeDef hdma_rx;
+#endif /* EE_M24LR64 */
   
   I2C_HandleTypeDef* pI2cHandle;
   pI2cHandle = &I2cHandle;
-#endif /* EE_M24LR64 */
 
   if (hi2c->Instance == DISCOVERY_I2Cx)
   {
@@ -329,13 +330,44 @@ static void I2Cx_MspInit(I2C_HandleTypeDef *hi2c)
     /* Release the I2C Peripheral Clock Reset */  
     DISCOVERY_I2Cx_RELEASE_RESET(); 
     
-    /* Enable and set Discovery I2Cx Interrupt to the lowest priority */
-    // HAL_NVIC_SetPriority(DISCOVERY_I2Cx_EV_IRQn, 0x0F, 0);
-    // HAL_NVIC_EnableIRQ(DISCOVERY_I2Cx_EV_IRQn);
+    /* Enable and set Discovery I2Cx Interrupt to the lowest priority, 
+       only the DMA transfers turn the event/error interrupts on */
+    HAL_NVIC_SetPriority(DISCOVERY_I2Cx_EV_IRQn, DISCOVERY_I2Cx_IT_PREPRIO, 0);
+    HAL_NVIC_EnableIRQ(DISCOVERY_I2Cx_EV_IRQn);
     
     /* Enable and set Discovery I2Cx Interrupt to the lowest priority */
-    // HAL_NVIC_SetPriority(DISCOVERY_I2Cx_ER_IRQn, 0x0F, 0);
-    // HAL_NVIC_EnableIRQ(DISCOVERY_I2Cx_ER_IRQn);  
+    HAL_NVIC_SetPriority(DISCOVERY_I2Cx_ER_IRQn, DISCOVERY_I2Cx_IT_PREPRIO, 0);
+    HAL_NVIC_EnableIRQ(DISCOVERY_I2Cx_ER_IRQn);  
+
+    /* I2C DMA RX channel configuration */
+    /* Enable the DMA clock */
+    DISCOVERY_I2Cx_DMA_CLK_ENABLE();
+
+    /* Configure the DMA stream for the I2C peripheral RX direction */
+    hdma_rx.Instance                  = DISCOVERY_I2Cx_DMA_STREAM_RX;
+    
+    hdma_rx.Init.Channel              = DISCOVERY_I2Cx_DMA_CHANNEL;  
+    hdma_rx.Init.Direction            = DMA_PERIPH_TO_MEMORY;
+    hdma_rx.Init.PeriphInc            = DMA_PINC_DISABLE;
+    hdma_rx.Init.MemInc               = DMA_MINC_ENABLE;
+    hdma_rx.Init.PeriphDataAlignment  = DMA_PDATAALIGN_BYTE;
+    hdma_rx.Init.MemDataAlignment     = DMA_MDATAALIGN_BYTE;
+    hdma_rx.Init.Mode                 = DMA_NORMAL;
+    hdma_rx.Init.Priority             = DMA_PRIORITY_VERY_HIGH;
+    hdma_rx.Init.FIFOMode             = DMA_FIFOMODE_ENABLE;         
+    hdma_rx.Init.FIFOThreshold        = DMA_FIFO_THRESHOLD_FULL;
+    hdma_rx.Init.MemBurst             = DMA_MBURST_SINGLE;
+    hdma_rx.Init.PeriphBurst          = DMA_PBURST_SINGLE; 
+
+    /* Associate the initilalized hdma_rx handle to the the pI2cHandle handle*/
+    __HAL_LINKDMA(pI2cHandle, hdmarx, hdma_rx);
+    
+    /* Configure the DMA Stream */
+    HAL_DMA_Init(&hdma_rx);
+    
+    /* Configure and enable I2C DMA RX Channel interrupt */
+    HAL_NVIC_SetPriority(DISCOVERY_I2Cx_DMA_RX_IRQn, DISCOVERY_I2Cx_DMA_PREPRIO, 0);
+    HAL_NVIC_EnableIRQ(DISCOVERY_I2Cx_DMA_RX_IRQn);
 
 #ifdef EE_M24LR64
     /* I2C DMA TX and RX channels configuration */
@@ -368,33 +400,6 @@ static void I2Cx_MspInit(I2C_HandleTypeDef *hi2c)
     /* Configure and enable I2C DMA TX Channel interrupt */
     HAL_NVIC_SetPriority((IRQn_Type)(EEPROM_I2C_DMA_TX_IRQn), EEPROM_I2C_DMA_PREPRIO, 0);
     HAL_NVIC_EnableIRQ((IRQn_Type)(EEPROM_I2C_DMA_TX_IRQn));
-    
-    /* Configure the DMA stream for the EE I2C peripheral TX direction */
-    /* Configure the DMA Stream */
-    hdma_rx.Instance                  = EEPROM_I2C_DMA_STREAM_RX;
-    /* Set the parameters to be configured */
-    hdma_rx.Init.Channel              = EEPROM_I2C_DMA_CHANNEL;  
-    hdma_rx.Init.Direction            = DMA_PERIPH_TO_MEMORY;
-    hdma_rx.Init.PeriphInc            = DMA_PINC_DISABLE;
-    hdma_rx.Init.MemInc               = DMA_MINC_ENABLE;
-    hdma_rx.Init.PeriphDataAlignment  = DMA_PDATAALIGN_BYTE;
-    hdma_rx.Init.MemDataAlignment     = DMA_MDATAALIGN_BYTE;
-    hdma_rx.Init.Mode                 = DMA_NORMAL;
-    hdma_rx.Init.Priority             = DMA_PRIORITY_VERY_HIGH;
-    hdma_rx.Init.FIFOMode             = DMA_FIFOMODE_ENABLE;         
-    hdma_rx.Init.FIFOThreshold        = DMA_FIFO_THRESHOLD_FULL;
-    hdma_rx.Init.MemBurst             = DMA_MBURST_SINGLE;
-    hdma_rx.Init.PeriphBurst          = DMA_PBURST_SINGLE; 
-
-    /* Associate the initilalized hdma_rx handle to the the pI2cHandle handle*/
-    __HAL_LINKDMA(pI2cHandle, hdmarx, hdma_rx);
-    
-    /* Configure the DMA Stream */
-    HAL_DMA_Init(&hdma_rx);
-    
-    /* Configure and enable I2C DMA RX Channel interrupt */
-    HAL_NVIC_SetPriority((IRQn_Type)(EEPROM_I2C_DMA_RX_IRQn), EEPROM_I2C_DMA_PREPRIO, 0);
-    HAL_NVIC_EnableIRQ((IRQn_Type)(EEPROM_I2C_DMA_RX_IRQn));
 #endif /* EE_M24LR64 */
   }
 }
@@ -463,7 +468,7 @@ void I2Cx_WriteData(uint8_t Addr, uint8_t Reg, uint8_t Value)
   }        
 }
 
-void I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value)
+uint8_t I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value)
 {
   HAL_StatusTypeDef status = HAL_OK;
   uint16_t val = __builtin_bswap16(Value);
@@ -475,7 +480,9 @@ void I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value)
   {
     /* Re-Initialize the BUS */
     I2Cx_Error();
+    return 1;
   }        
+  return 0;
 }
 
 /**
@@ -484,8 +491,9 @@ void I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value)
   * @param  Reg: The target register address to write
   * @param  pBuffer: The target register value to be written 
   * @param  Length: buffer size to be written
+  * @retval 0 on success, 1 if the bus had to be re-initialized
   */
-void I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg,  uint8_t *pBuffer, uint16_t Length)
+uint8_t I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg,  uint8_t *pBuffer, uint16_t Length)
   {
   HAL_StatusTypeDef status = HAL_OK;
   
@@ -496,7 +504,9 @@ void I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg,  uint8_t *pBuffer, uint16_t Len
   {
     /* Re-Initialize the BUS */
     I2Cx_Error();
+    return 1;
   }        
+  return 0;
 }
 
 void I2Cx_WriteBuffer16(uint8_t Addr, uint16_t Reg,  uint16_t *pBuffer, uint16_t Length)
@@ -613,6 +623,103 @@ uint8_t I2Cx_ReadBuffer16(uint8_t Addr, uint16_t Reg, uint16_t *pBuffer, uint16_
   }
 }
 
+/**
+  * @brief  Starts reading 16-bit big-endian words on the BUS in DMA mode.
+  * @note   Returns before the transfer is done, HAL_I2C_MemRxCpltCallback or
+  *         HAL_I2C_ErrorCallback signals the end. Bytes are not swapped.
+  * @param  Addr: I2C Address
+  * @param  Reg: Reg Address 
+  * @param  pBuffer: pointer to read data buffer, must stay valid until completion
+  * @param  Length: length of the data in bytes
+  * @retval 0 if the transfer was started
+  */
+uint8_t I2Cx_ReadBuffer16DMA(uint8_t Addr, uint16_t Reg, uint16_t *pBuffer, uint16_t Length)
+{
+  HAL_StatusTypeDef status = HAL_OK;
+
+  status = HAL_I2C_Mem_Read_DMA(&I2cHandle, Addr, Reg, I2C_MEMADD_SIZE_16BIT, (uint8_t*)pBuffer, Length);
+  
+  /* Check the communication status */
+  if(status == HAL_OK)
+  {
+    return 0;
+  }
+  else
+  {
+    /* Re-Initialize the BUS */
+    I2Cx_Error();
+
+    return 1;
+  }
+}
+
+/**
+  * @brief  Clears a bus held by a slave left in the middle of a byte: the DMA is
+  *         aborted, SCL is toggled up to 9 times until SDA is released, a STOP is
+  *         generated and the peripheral is re-initialized.
+  * @retval 0 if SDA was released
+  */
+uint8_t I2Cx_BusClear(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct;
+  uint8_t pulses = 0;
+
+  if(I2cHandle.hdmarx != NULL)
+  {
+    HAL_DMA_Abort(I2cHandle.hdmarx);
+  }
+  HAL_I2C_DeInit(&I2cHandle);
+
+  /* Both lines as open-drain GPIO, released high */
+  GPIO_InitStruct.Mode  = GPIO_MODE_OUTPUT_OD;
+  GPIO_InitStruct.Pull  = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FAST;
+  GPIO_InitStruct.Pin   = DISCOVERY_I2Cx_SCL_PIN;
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SCL_GPIO_PORT, DISCOVERY_I2Cx_SCL_PIN, GPIO_PIN_SET);
+  HAL_GPIO_Init(DISCOVERY_I2Cx_SCL_GPIO_PORT, &GPIO_InitStruct);
+  GPIO_InitStruct.Pin   = DISCOVERY_I2Cx_SDA_PIN;
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SDA_GPIO_PORT, DISCOVERY_I2Cx_SDA_PIN, GPIO_PIN_SET);
+  HAL_GPIO_Init(DISCOVERY_I2Cx_SDA_GPIO_PORT, &GPIO_InitStruct);
+  I2Cx_BitDelay();
+
+  /* Clock out whatever byte the slave is still sending */
+  while((HAL_GPIO_ReadPin(DISCOVERY_I2Cx_SDA_GPIO_PORT, DISCOVERY_I2Cx_SDA_PIN) == GPIO_PIN_RESET) && (pulses < 9))
+  {
+    HAL_GPIO_WritePin(DISCOVERY_I2Cx_SCL_GPIO_PORT, DISCOVERY_I2Cx_SCL_PIN, GPIO_PIN_RESET);
+    I2Cx_BitDelay();
+    HAL_GPIO_WritePin(DISCOVERY_I2Cx_SCL_GPIO_PORT, DISCOVERY_I2Cx_SCL_PIN, GPIO_PIN_SET);
+    I2Cx_BitDelay();
+    pulses++;
+  }
+  const uint8_t released = (HAL_GPIO_ReadPin(DISCOVERY_I2Cx_SDA_GPIO_PORT, DISCOVERY_I2Cx_SDA_PIN) == GPIO_PIN_SET);
+
+  /* STOP: SDA rises while SCL is high */
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SCL_GPIO_PORT, DISCOVERY_I2Cx_SCL_PIN, GPIO_PIN_RESET);
+  I2Cx_BitDelay();
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SDA_GPIO_PORT, DISCOVERY_I2Cx_SDA_PIN, GPIO_PIN_RESET);
+  I2Cx_BitDelay();
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SCL_GPIO_PORT, DISCOVERY_I2Cx_SCL_PIN, GPIO_PIN_SET);
+  I2Cx_BitDelay();
+  HAL_GPIO_WritePin(DISCOVERY_I2Cx_SDA_GPIO_PORT, DISCOVERY_I2Cx_SDA_PIN, GPIO_PIN_SET);
+  I2Cx_BitDelay();
+
+  /* MspInit puts the pins back on the alternate function */
+  I2Cx_Init();
+  return released ? 0 : 1;
+}
+
+/**
+  * @brief  About half a 100 kHz bit time (5 us) at the configured core clock,
+  *         the volatile loop takes about 4 cycles per pass.
+  */
+static void I2Cx_BitDelay(void)
+{
+  const uint32_t passes = SystemCoreClock / 800000U;
+  for(volatile uint32_t i = 0; i < passes; i++)
+  {
+  }
+}
+
 #ifdef EE_M24LR64
 /**
   * @brief  Writes a value in a register of the device through BUS in using DMA mode.
@@ -172,6 +172,14 @@ typedef enum
 /* Definition for IOE I2Cx's NVIC */
 #define DISCOVERY_I2Cx_EV_IRQn                  I2C3_EV_IRQn
 #define DISCOVERY_I2Cx_ER_IRQn                  I2C3_ER_IRQn
+#define DISCOVERY_I2Cx_IT_PREPRIO               0x0F
+
+/* Definition for DISCO I2Cx's DMA (RX, used for sensor frame readout) */
+#define DISCOVERY_I2Cx_DMA_CLK_ENABLE()         __HAL_RCC_DMA1_CLK_ENABLE()
+#define DISCOVERY_I2Cx_DMA_CHANNEL              DMA_CHANNEL_3
+#define DISCOVERY_I2Cx_DMA_STREAM_RX            DMA1_Stream2
+#define DISCOVERY_I2Cx_DMA_RX_IRQn              DMA1_Stream2_IRQn
+#define DISCOVERY_I2Cx_DMA_PREPRIO              0x0F
 
 /* I2C clock speed configuration (in Hz) 
   WARNING: 
@@ -325,13 +333,15 @@ uint32_t BSP_PB_GetState(Button_TypeDef Button);
 void     I2Cx_Init(void);
 void     I2Cx_ITConfig(void);
 void     I2Cx_WriteData(uint8_t Addr, uint8_t Reg, uint8_t Value);
-void     I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value);
-void     I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg,  uint8_t *pBuffer, uint16_t Length);
+uint8_t  I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value);
+uint8_t  I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg,  uint8_t *pBuffer, uint16_t Length);
 void     I2Cx_WriteBuffer16(uint8_t Addr, uint16_t Reg, uint16_t *pBuffer, uint16_t Length);
 uint8_t  I2Cx_ReadData(uint8_t Addr, uint8_t Reg);
 uint16_t  I2Cx_ReadData16(uint8_t Addr, uint16_t Reg);
 uint8_t  I2Cx_ReadBuffer(uint8_t Addr, uint8_t Reg, uint8_t *pBuffer, uint16_t Length);
 uint8_t  I2Cx_ReadBuffer16(uint8_t Addr, uint16_t Reg, uint16_t *pBuffer, uint16_t Length);
+uint8_t  I2Cx_ReadBuffer16DMA(uint8_t Addr, uint16_t Reg, uint16_t *pBuffer, uint16_t Length);
+uint8_t  I2Cx_BusClear(void);
 
 /**
   * @}
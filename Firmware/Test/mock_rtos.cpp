@@ -0,0 +1,193 @@
+/* Single-threaded RTOS mock: the scheduler never starts, so the bus executes every transfer in the
+   caller. Time only moves when the code delays, times out, or busy-waits on a stalled DMA. */
+#include "mock_sensor.h"
+#include <deque>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	std::deque<std::vector<uint8_t> > items;
+} mock_queue_t;
+
+typedef struct {
+	UBaseType_t maxCount;
+	UBaseType_t count;
+} mock_semaphore_t;
+
+static uint32_t ticks = 0;
+static uint32_t notifications = 0;
+static int mainTask = 0;
+static bool dmaStalled = false;
+static bool dmaWaitStarted = false;
+static I2CBus* dmaBus = NULL;
+
+void mockAdvanceTicks(const uint32_t count)
+{
+	ticks += count;
+}
+
+/* The bus spins on HAL_GetTick while a DMA is outstanding, each poll after the one that starts the
+   wait is one tick */
+uint32_t HAL_GetTick(void)
+{
+	if (dmaStalled)
+	{
+		ticks += dmaWaitStarted ? 1 : 0;
+		dmaWaitStarted = true;
+	}
+	return ticks;
+}
+
+void HAL_Delay(uint32_t delay)
+{
+	ticks += delay;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return ticks;
+}
+
+void vTaskDelay(TickType_t delay)
+{
+	ticks += delay;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return &mainTask;
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return taskSCHEDULER_NOT_STARTED;
+}
+
+/* Nothing else runs, so a take that finds no notification times out at once */
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout)
+{
+	const uint32_t value = notifications;
+	if (value == 0)
+	{
+		ticks += (timeout == portMAX_DELAY) ? 0 : timeout;
+		return 0;
+	}
+	notifications = clearOnExit ? 0 : value - 1;
+	return value;
+}
+
+/* configASSERT(xTaskToNotify) on the target */
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	if (task == NULL)
+	{
+		fprintf(stderr, "xTaskNotifyGive(NULL)\n");
+		abort();
+	}
+	notifications++;
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken)
+{
+	xTaskNotifyGive(task);
+	if (higherPriorityTaskWoken != NULL)
+	{
+		*higherPriorityTaskWoken = pdTRUE;
+	}
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	mock_queue_t* queue = new mock_queue_t;
+	queue->length = length;
+	queue->itemSize = itemSize;
+	return queue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t handle, const void* item, TickType_t timeout)
+{
+	mock_queue_t* queue = (mock_queue_t*)handle;
+	if (queue->items.size() >= queue->length)
+	{
+		ticks += (timeout == portMAX_DELAY) ? 0 : timeout;
+		return pdFAIL;
+	}
+	const uint8_t* bytes = (const uint8_t*)item;
+	queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+	return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t timeout)
+{
+	mock_queue_t* queue = (mock_queue_t*)handle;
+	if (queue->items.empty())
+	{
+		ticks += (timeout == portMAX_DELAY) ? 0 : timeout;
+		return pdFAIL;
+	}
+	memcpy(item, queue->items.front().data(), queue->itemSize);
+	queue->items.pop_front();
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+	mock_semaphore_t* semaphore = new mock_semaphore_t;
+	semaphore->maxCount = maxCount;
+	semaphore->count = initialCount;
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t timeout)
+{
+	mock_semaphore_t* semaphore = (mock_semaphore_t*)handle;
+	if (semaphore->count == 0)
+	{
+		ticks += (timeout == portMAX_DELAY) ? 0 : timeout;
+		return pdFAIL;
+	}
+	semaphore->count--;
+	return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+	mock_semaphore_t* semaphore = (mock_semaphore_t*)handle;
+	if (semaphore->count >= semaphore->maxCount)
+	{
+		return pdFAIL;
+	}
+	semaphore->count++;
+	return pdPASS;
+}
+
+void mockAttachBus(I2CBus* bus)
+{
+	dmaBus = bus;
+}
+
+void mockDmaAbort()
+{
+	dmaStalled = false;
+}
+
+/* Completes in the call, the interrupt fires before the bus starts waiting for it */
+uint8_t I2Cx_ReadBuffer16DMA(uint8_t Addr, uint16_t Reg, uint16_t* pBuffer, uint16_t Length)
+{
+	(void)Addr;
+	if (!mockDmaAttempt())
+	{
+		dmaStalled = true;
+		dmaWaitStarted = false;
+		return 0;
+	}
+	mockDmaCopy(Reg, pBuffer, Length);
+	BaseType_t woken = pdFALSE;
+	dmaBus->transferCompleteFromISR(false, &woken);
+	return 0;
+}
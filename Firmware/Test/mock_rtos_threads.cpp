@@ -0,0 +1,278 @@
+/* Threaded RTOS mock: every task is a std::thread, a tick is a millisecond of real time and a DMA
+   engine thread completes transfers asynchronously, like the interrupt on the target. Before
+   mockStartScheduler() the bus runs transfers in the caller, as it does on the target before
+   vTaskStartScheduler. */
+#include "mock_sensor.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	std::mutex lock;
+	std::condition_variable wake;
+	uint32_t notifications;
+} mock_task_t;
+
+typedef struct {
+	std::mutex lock;
+	std::condition_variable wake;
+	UBaseType_t length;
+	UBaseType_t itemSize;
+	std::deque<std::vector<uint8_t> > items;
+} mock_queue_t;
+
+typedef struct {
+	std::mutex lock;
+	std::condition_variable wake;
+	UBaseType_t maxCount;
+	UBaseType_t count;
+} mock_semaphore_t;
+
+typedef struct {
+	uint16_t reg;
+	uint16_t* data;
+	uint16_t length;
+} mock_dma_request_t;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+static thread_local mock_task_t* currentTask = NULL;
+static volatile bool schedulerRunning = false;
+static I2CBus* volatile dmaBus = NULL;
+static std::mutex dmaLock;
+static std::condition_variable dmaWake;
+static std::deque<mock_dma_request_t> dmaRequests;
+static std::once_flag dmaEngineStarted;
+static std::mutex kernelLock;
+
+/* Every FreeRTOS call runs in a critical section, which orders the task's memory accesses around it */
+static void enterKernel()
+{
+	std::lock_guard<std::mutex> lock(kernelLock);
+}
+
+/* Waits on a condition for a FreeRTOS timeout in ticks */
+template <typename Predicate>
+static bool waitFor(std::condition_variable& wake, std::unique_lock<std::mutex>& lock, const TickType_t timeout, Predicate ready)
+{
+	if (timeout == portMAX_DELAY)
+	{
+		wake.wait(lock, ready);
+		return true;
+	}
+	return wake.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+}
+
+void mockStartScheduler()
+{
+	schedulerRunning = true;
+}
+
+void mockAdvanceTicks(const uint32_t count)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(count));
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void HAL_Delay(uint32_t delay)
+{
+	mockAdvanceTicks(delay);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return HAL_GetTick();
+}
+
+void vTaskDelay(TickType_t delay)
+{
+	mockAdvanceTicks(delay);
+	enterKernel();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (currentTask == NULL)
+	{
+		currentTask = new mock_task_t;
+		currentTask->notifications = 0;
+	}
+	return currentTask;
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return schedulerRunning ? taskSCHEDULER_RUNNING : taskSCHEDULER_NOT_STARTED;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout)
+{
+	enterKernel();
+	mock_task_t* task = (mock_task_t*)xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->lock);
+	if (!waitFor(task->wake, lock, timeout, [task] { return task->notifications > 0; }))
+	{
+		return 0;
+	}
+	const uint32_t value = task->notifications;
+	task->notifications = clearOnExit ? 0 : value - 1;
+	return value;
+}
+
+/* configASSERT(xTaskToNotify) on the target */
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+	if (handle == NULL)
+	{
+		fprintf(stderr, "xTaskNotifyGive(NULL)\n");
+		abort();
+	}
+	mock_task_t* task = (mock_task_t*)handle;
+	{
+		std::lock_guard<std::mutex> lock(task->lock);
+		task->notifications++;
+	}
+	task->wake.notify_all();
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken)
+{
+	xTaskNotifyGive(task);
+	if (higherPriorityTaskWoken != NULL)
+	{
+		*higherPriorityTaskWoken = pdTRUE;
+	}
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+	mock_queue_t* queue = new mock_queue_t;
+	queue->length = length;
+	queue->itemSize = itemSize;
+	return queue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t handle, const void* item, TickType_t timeout)
+{
+	enterKernel();
+	mock_queue_t* queue = (mock_queue_t*)handle;
+	std::unique_lock<std::mutex> lock(queue->lock);
+	if (!waitFor(queue->wake, lock, timeout, [queue] { return queue->items.size() < queue->length; }))
+	{
+		return pdFAIL;
+	}
+	const uint8_t* bytes = (const uint8_t*)item;
+	queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+	queue->wake.notify_all();
+	return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t timeout)
+{
+	enterKernel();
+	mock_queue_t* queue = (mock_queue_t*)handle;
+	std::unique_lock<std::mutex> lock(queue->lock);
+	if (!waitFor(queue->wake, lock, timeout, [queue] { return !queue->items.empty(); }))
+	{
+		return pdFAIL;
+	}
+	memcpy(item, queue->items.front().data(), queue->itemSize);
+	queue->items.pop_front();
+	queue->wake.notify_all();
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+	mock_semaphore_t* semaphore = new mock_semaphore_t;
+	semaphore->maxCount = maxCount;
+	semaphore->count = initialCount;
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t timeout)
+{
+	enterKernel();
+	mock_semaphore_t* semaphore = (mock_semaphore_t*)handle;
+	std::unique_lock<std::mutex> lock(semaphore->lock);
+	if (!waitFor(semaphore->wake, lock, timeout, [semaphore] { return semaphore->count > 0; }))
+	{
+		return pdFAIL;
+	}
+	semaphore->count--;
+	return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle)
+{
+	enterKernel();
+	mock_semaphore_t* semaphore = (mock_semaphore_t*)handle;
+	{
+		std::lock_guard<std::mutex> lock(semaphore->lock);
+		if (semaphore->count >= semaphore->maxCount)
+		{
+			return pdFAIL;
+		}
+		semaphore->count++;
+	}
+	semaphore->wake.notify_all();
+	return pdPASS;
+}
+
+void mockAttachBus(I2CBus* bus)
+{
+	dmaBus = bus;
+}
+
+/* A stalled transfer never reached the engine, there is nothing to cancel */
+void mockDmaAbort()
+{
+}
+
+/* Plays the DMA controller and its transfer-complete interrupt */
+static void dmaEngine()
+{
+	for (;;)
+	{
+		mock_dma_request_t request;
+		{
+			std::unique_lock<std::mutex> lock(dmaLock);
+			dmaWake.wait(lock, [] { return !dmaRequests.empty(); });
+			request = dmaRequests.front();
+			dmaRequests.pop_front();
+		}
+		mockDmaCopy(request.reg, request.data, request.length);
+		BaseType_t woken = pdFALSE;
+		dmaBus->transferCompleteFromISR(false, &woken);
+	}
+}
+
+uint8_t I2Cx_ReadBuffer16DMA(uint8_t Addr, uint16_t Reg, uint16_t* pBuffer, uint16_t Length)
+{
+	(void)Addr;
+	std::call_once(dmaEngineStarted, [] { std::thread(dmaEngine).detach(); });
+	if (!mockDmaAttempt())
+	{
+		return 0;
+	}
+	mock_dma_request_t request;
+	request.reg = Reg;
+	request.data = pBuffer;
+	request.length = Length;
+	{
+		std::lock_guard<std::mutex> lock(dmaLock);
+		dmaRequests.push_back(request);
+	}
+	dmaWake.notify_all();
+	return 0;
+}
@@ -0,0 +1,351 @@
+#include "mock_sensor.h"
+#include <thermal.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define CALIB_CACHE_SECTOR_SIZE 0x20000
+
+DWT_Type dwtRegisters;
+CoreDebug_Type coreDebugRegisters;
+DWT_Type* const DWT = &dwtRegisters;
+CoreDebug_Type* const CoreDebug = &coreDebugRegisters;
+
+static std::recursive_mutex sensorLock;
+static uint16_t eeprom[832];
+static uint16_t frameRam[832];
+static uint16_t statusRegister = 0x0000;
+static uint16_t controlRegister = MOCK_CONTROL_POWER_ON;
+static mock_faults_t faults;
+static mock_counters_t counters;
+static int dmaStallsLeft = 0;
+static bool readWindowOpen = true;
+static uint32_t rng = 1;
+static uint8_t* flash = NULL;
+
+static int randomInt(const int lo, const int hi)
+{
+	rng = rng * 1103515245u + 12345u;
+	return lo + (int)((rng >> 8) % (uint32_t)(hi - lo + 1));
+}
+
+/* Calibration sector at its real address, so the firmware's uint32_t flash addresses work unchanged */
+static struct FlashSector {
+	FlashSector()
+	{
+		void* sector = mmap((void*)(uintptr_t)CALIB_CACHE_ADDR, CALIB_CACHE_SECTOR_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (sector != (void*)(uintptr_t)CALIB_CACHE_ADDR)
+		{
+			fprintf(stderr, "cannot map the calibration sector at 0x%08X\n", (unsigned)CALIB_CACHE_ADDR);
+			exit(2);
+		}
+		flash = (uint8_t*)sector;
+		memset(flash, 0xFF, CALIB_CACHE_SECTOR_SIZE);
+	}
+} flashSector;
+
+/* A plausible calibration with one broken (100) and two outlier (37, 200) pixels */
+void mockGenerateEE(const uint32_t seed)
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	rng = seed;
+	for (int i = 0; i < 64; i++) eeprom[i] = randomInt(0, 0xFFFF);
+	eeprom[MOCK_SERIAL_WORD] = 0x1234;
+	eeprom[10] = 0x0000;
+	eeprom[16] = 0x4210; eeprom[17] = 0xFFB0;
+	for (int i = 18; i < 32; i++) eeprom[i] = randomInt(0, 0xFFFF) & 0x3333;
+	eeprom[32] = 0x6321; eeprom[33] = 12100;
+	for (int i = 34; i < 48; i++) eeprom[i] = randomInt(0, 0xFFFF) & 0x3333;
+	eeprom[48] = 0x18EF; eeprom[49] = 0x2FF1; eeprom[50] = 0x2550; eeprom[51] = 0x9D68;
+	eeprom[52] = 0x4444; eeprom[53] = 0x2A45; eeprom[54] = 0x5050; eeprom[55] = 0x4B53;
+	eeprom[56] = 0x2462; eeprom[57] = 0x0822; eeprom[58] = 0x0BBA; eeprom[59] = 0x0A4F;
+	eeprom[60] = 0xF000; eeprom[61] = 0xF8F8; eeprom[62] = 0xF8F8; eeprom[63] = 0x1A55;
+	for (int i = 64; i < 832; i++)
+	{
+		eeprom[i] = randomInt(0, 0xFFFF) & 0xFFFE;
+		if (eeprom[i] == 0)
+		{
+			eeprom[i] = 2;
+		}
+	}
+	eeprom[64 + 100] = 0;
+	eeprom[64 + 37] |= 1;
+	eeprom[64 + 200] |= 1;
+}
+
+/* Random fields everywhere, kept in the ranges where the Melexis scale loops terminate */
+void mockGenerateRandomEE(const uint32_t seed)
+{
+	mockGenerateEE(seed);
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	eeprom[10] = randomInt(0, 1) << 11;
+	eeprom[16] = (randomInt(0, 0xF) << 12) | (randomInt(0, 4) << 8) | (randomInt(0, 4) << 4) | randomInt(0, 3);
+	eeprom[17] = randomInt(0, 0xFFFF);
+	eeprom[32] = (randomInt(4, 7) << 12) | (randomInt(0, 4) << 8) | (randomInt(0, 4) << 4) | randomInt(0, 3);
+	eeprom[33] = randomInt(12000, 16000);
+	for (int i = 48; i < 52; i++) eeprom[i] = randomInt(0, 0xFFFF);
+	eeprom[52] = (randomInt(1, 7) << 12) | (randomInt(1, 7) << 8) | (randomInt(1, 7) << 4) | randomInt(1, 7);
+	eeprom[53] = randomInt(0, 0xFFFF);
+	eeprom[54] = (randomInt(0x20, 0x5F) << 8) | randomInt(0x20, 0x5F);
+	eeprom[55] = (randomInt(0x20, 0x5F) << 8) | randomInt(0x20, 0x5F);
+	eeprom[56] = (randomInt(0, 3) << 12) | (randomInt(0, 7) << 8) | (randomInt(0, 7) << 4) | randomInt(0, 3);
+	for (int i = 58; i < 64; i++) eeprom[i] = randomInt(0, 0xFFFF);
+	/* CP alpha times tgc stays well below the smallest pixel alpha, as on real parts */
+	eeprom[57] = (randomInt(0, 0x3F) << 10) | randomInt(0, 0xFF);
+	eeprom[60] = (eeprom[60] & 0xFF00) | randomInt(0, 0x08);
+	for (int i = 64; i < 832; i++)
+	{
+		eeprom[i] = randomInt(0, 0xFFFF);
+	}
+	eeprom[64 + randomInt(0, 767)] = 0;
+}
+
+uint16_t* mockEE()
+{
+	return eeprom;
+}
+
+uint16_t* mockFrameRam()
+{
+	return frameRam;
+}
+
+/* Subpage n of a steady scene with a hot spot at pixel 300, auxiliary words drift slightly with n */
+void mockFillFrame(const uint8_t subPage, const int n)
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	for (int i = 0; i < 768; i++)
+	{
+		frameRam[i] = (uint16_t)(int16_t)(-60 + randomInt(0, 300) + ((i == 300) ? 2000 : 0) + n);
+	}
+	frameRam[768] = 19200;
+	frameRam[800] = 1711 + (n % 5);
+	frameRam[810] = (uint16_t)(int16_t)(-13115 + (n % 7));
+	frameRam[778] = 6383;
+	frameRam[776] = (uint16_t)(int16_t)-60;
+	frameRam[808] = (uint16_t)(int16_t)-58;
+	mockPresentSubPage(subPage);
+}
+
+/* Sets "new data available" for the subpage currently in frame RAM */
+void mockPresentSubPage(const uint8_t subPage)
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	statusRegister = 0x0008 | subPage;
+}
+
+uint16_t mockControl()
+{
+	return controlRegister;
+}
+
+void mockLock()
+{
+	sensorLock.lock();
+}
+
+void mockUnlock()
+{
+	sensorLock.unlock();
+}
+
+mock_faults_t* mockFaults()
+{
+	return &faults;
+}
+
+mock_counters_t* mockCounters()
+{
+	return &counters;
+}
+
+void mockResetFaults()
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	memset(&faults, 0, sizeof(faults));
+	memset(&counters, 0, sizeof(counters));
+	dmaStallsLeft = 0;
+}
+
+void mockSetReadWindow(const bool open)
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	readWindowOpen = open;
+}
+
+uint8_t* mockFlash()
+{
+	return flash;
+}
+
+void mockEraseFlash()
+{
+	memset(flash, 0xFF, CALIB_CACHE_SECTOR_SIZE);
+}
+
+/* An injected fault, the sensor may have browned out with it */
+static void injectFault()
+{
+	if (faults.resetOnFault)
+	{
+		controlRegister = MOCK_CONTROL_POWER_ON;
+	}
+}
+
+/* Counts a DMA transfer, false if the fault plan stalls it */
+bool mockDmaAttempt()
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	counters.dmaTransfers++;
+	if (counters.dmaTransfers == faults.dmaFailAt)
+	{
+		dmaStallsLeft = faults.dmaFailRun;
+	}
+	if (dmaStallsLeft > 0)
+	{
+		dmaStallsLeft--;
+		injectFault();
+		return false;
+	}
+	return true;
+}
+
+static uint16_t readRegister(const uint16_t reg)
+{
+	if (reg == 0x8000)
+	{
+		return statusRegister;
+	}
+	if (reg == 0x800D)
+	{
+		return controlRegister;
+	}
+	if (reg >= 0x2400 && reg < 0x2400 + 832)
+	{
+		return eeprom[reg - 0x2400];
+	}
+	if (reg >= 0x0400 && reg < 0x0400 + 832)
+	{
+		return frameRam[reg - 0x0400];
+	}
+	return 0;
+}
+
+/* Frame RAM as the DMA delivers it, big-endian words */
+void mockDmaCopy(const uint16_t reg, uint16_t* data, const uint16_t length)
+{
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	if (!readWindowOpen)
+	{
+		counters.lateDmaWrites++;
+	}
+	for (uint16_t i = 0; i < length / 2; i++)
+	{
+		data[i] = (uint16_t)__REV16(readRegister(reg + i));
+	}
+}
+
+uint8_t I2Cx_ReadBuffer16(uint8_t Addr, uint16_t Reg, uint16_t* pBuffer, uint16_t Length)
+{
+	(void)Addr;
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	if (++counters.wordReads == faults.readFailAt)
+	{
+		injectFault();
+		mockAdvanceTicks(2);
+		return 1;
+	}
+	for (uint16_t i = 0; i < Length / 2; i++)
+	{
+		pBuffer[i] = readRegister(Reg + i);
+	}
+	return 0;
+}
+
+uint8_t I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value)
+{
+	(void)Addr;
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	if (++counters.wordWrites == faults.wordWriteFailAt)
+	{
+		injectFault();
+		mockAdvanceTicks(2);
+		return 1;
+	}
+	if (Reg == 0x800D)
+	{
+		controlRegister = Value;
+	}
+	else if (Reg == 0x8000)
+	{
+		statusRegister = Value;
+	}
+	return 0;
+}
+
+uint8_t I2Cx_ReadBuffer(uint8_t Addr, uint8_t Reg, uint8_t* pBuffer, uint16_t Length)
+{
+	(void)Addr;
+	(void)Reg;
+	memset(pBuffer, 0, Length);
+	return 0;
+}
+
+uint8_t I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg, uint8_t* pBuffer, uint16_t Length)
+{
+	(void)Addr;
+	(void)Reg;
+	(void)pBuffer;
+	(void)Length;
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	if (++counters.byteWrites == faults.writeFailAt)
+	{
+		injectFault();
+		return 1;
+	}
+	return 0;
+}
+
+/* Aborts a stalled DMA, SDA stays low for the first faults.stuckClears calls */
+uint8_t I2Cx_BusClear(void)
+{
+	mockDmaAbort();
+	std::lock_guard<std::recursive_mutex> lock(sensorLock);
+	counters.busClears++;
+	mockAdvanceTicks(1);
+	return (counters.busClears <= faults.stuckClears) ? 1 : 0;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* sectorError)
+{
+	(void)erase;
+	*sectorError = 0xFFFFFFFFU;
+	mockEraseFlash();
+	counters.flashErases++;
+	return HAL_OK;
+}
+
+/* Programming can only clear bits, like the real array */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t typeProgram, uint32_t address, uint64_t data)
+{
+	(void)typeProgram;
+	uint8_t* cell = (uint8_t*)(uintptr_t)address;
+	uint32_t word;
+	memcpy(&word, cell, sizeof(word));
+	word &= (uint32_t)data;
+	memcpy(cell, &word, sizeof(word));
+	return HAL_OK;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef __MOCK_SENSOR_H
+#define __MOCK_SENSOR_H
+
+/* MLX90640 on I2C3 as the host tests see it: EEPROM, frame RAM, status and control registers,
+   the calibration flash sector, and a fault plan for the bus transfers */
+#include <stdint.h>
+#include <i2c_bus.h>
+
+#define MOCK_SERIAL_WORD 7 ///< EEPROM word of the first serial number word (0x2407)
+#define MOCK_CONTROL_POWER_ON 0x1901 ///< 0x800D after a reset: 2 Hz, 18 bit, chess
+
+/** Transfers to break, counted from 1 since the last mockResetFaults() */
+typedef struct {
+	int dmaFailAt;   ///< first DMA transfer that never completes, 0 for none
+	int dmaFailRun;  ///< consecutive DMA transfers that stall from dmaFailAt on
+	int readFailAt;  ///< blocking word read that fails
+	int writeFailAt; ///< 8-bit register write that fails
+	int wordWriteFailAt; ///< 16-bit register write that fails
+	int stuckClears; ///< bus clears that leave SDA low
+	bool resetOnFault; ///< every injected fault comes with a sensor reset, 0x800D goes back to MOCK_CONTROL_POWER_ON
+} mock_faults_t;
+
+typedef struct {
+	int dmaTransfers;
+	int wordReads;
+	int byteWrites;
+	int wordWrites;
+	int busClears;
+	int flashErases;
+	int lateDmaWrites; ///< DMA data that landed while the read window was closed
+} mock_counters_t;
+
+/* Sensor model */
+void mockGenerateEE(uint32_t seed);
+void mockGenerateRandomEE(uint32_t seed);
+uint16_t* mockEE();
+uint16_t* mockFrameRam();
+void mockFillFrame(uint8_t subPage, int n);
+void mockPresentSubPage(uint8_t subPage);
+uint16_t mockControl();
+void mockLock();
+void mockUnlock();
+
+/* Faults and counters */
+mock_faults_t* mockFaults();
+mock_counters_t* mockCounters();
+void mockResetFaults();
+void mockSetReadWindow(bool open);
+
+/* Calibration flash sector at CALIB_CACHE_ADDR */
+uint8_t* mockFlash();
+void mockEraseFlash();
+
+/* DMA plumbing shared with the RTOS mock */
+bool mockDmaAttempt();
+void mockDmaCopy(uint16_t reg, uint16_t* data, uint16_t length);
+void mockAttachBus(I2CBus* bus);
+
+/* Implemented by the RTOS mock */
+void mockDmaAbort();
+void mockAdvanceTicks(uint32_t ticks);
+void mockStartScheduler(); ///< threaded mock only
+
+#endif /* __MOCK_SENSOR_H */
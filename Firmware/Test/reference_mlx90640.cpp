@@ -0,0 +1,629 @@
+/* Reference MLX90640 math for the host tests. The EEPROM parse is the float parser the firmware used
+   before the integer extraction, kept verbatim except that the sign extensions it left to the narrowing
+   into int16_t/int8_t are written as casts and CP is extracted before alpha, whose correction uses it, as in
+   the Melexis driver; the To solve follows the Melexis driver in double. */
+#include "reference_mlx90640.h"
+#include <math.h>
+
+void referenceConvertEE(const uint16_t* mlxEE, paramsMLX90640_t& mlxParams)
+{
+	/* Vdd */
+
+	int16_t kVdd = (mlxEE[51] & 0xFF00) >> 8;
+    if(kVdd > 127)
+    {
+        kVdd = kVdd - 256;
+    }
+    kVdd = 32 * kVdd;
+    int16_t vdd25 = mlxEE[51] & 0x00FF;
+    vdd25 = ((vdd25 - 256) << 5) - 8192;
+    
+    mlxParams.kVdd = kVdd;
+    mlxParams.vdd25 = vdd25;
+
+	/* PTAT */
+    float KvPTAT = (mlxEE[50] & 0xFC00) >> 10;
+    if(KvPTAT > 31)
+    {
+        KvPTAT = KvPTAT - 64;
+    }
+    KvPTAT = KvPTAT/4096;
+    int16_t KtPTAT = mlxEE[50] & 0x03FF;
+    if(KtPTAT > 511)
+    {
+        KtPTAT = KtPTAT - 1024;
+    }
+    KtPTAT = KtPTAT/8;
+	const int16_t vPTAT25 = mlxEE[49];
+	const float alphaPTAT = (mlxEE[16] & 0xF000) / 16384.0f + 8.0f;
+    
+    mlxParams.KvPTAT = KvPTAT;
+    mlxParams.KtPTAT = KtPTAT;    
+    mlxParams.vPTAT25 = vPTAT25;
+    mlxParams.alphaPTAT = alphaPTAT;
+
+	/* Gain */
+    const int16_t gainEE = (int16_t)mlxEE[48];
+    
+    mlxParams.gainEE = gainEE;
+
+	/* Tgc */
+    float tgc = mlxEE[60] & 0x00FF;
+    if(tgc > 127)
+    {
+        tgc = tgc - 256;
+    }
+    tgc = tgc / 32.0f;
+    
+    mlxParams.tgc = tgc;
+
+	/* Resolution */
+	const uint8_t resolutionEE = (mlxEE[56] & 0x3000) >> 12;    
+    
+    mlxParams.resolutionEE = resolutionEE;
+
+	/* KsTa */
+    float KsTa = (mlxEE[60] & 0xFF00) >> 8;
+    if(KsTa > 127)
+    {
+        KsTa = KsTa -256;
+    }
+    KsTa = KsTa / 8192.0f;
+    
+    mlxParams.KsTa = KsTa;
+
+	/* KsTo */
+    int8_t step = ((mlxEE[63] & 0x3000) >> 12) * 10;
+    
+    mlxParams.ct[0] = -40;
+    mlxParams.ct[1] = 0;
+    mlxParams.ct[2] = (mlxEE[63] & 0x00F0) >> 4;
+    mlxParams.ct[3] = (mlxEE[63] & 0x0F00) >> 8;    
+    
+    mlxParams.ct[2] = mlxParams.ct[2]*step;
+    mlxParams.ct[3] = mlxParams.ct[2] + mlxParams.ct[3]*step;
+    mlxParams.ct[4] = 400;
+
+    int KsToScale = (mlxEE[63] & 0x000F) + 8;
+    KsToScale = 1 << KsToScale;
+    
+    mlxParams.ksTo[0] = mlxEE[61] & 0x00FF;
+    mlxParams.ksTo[1] = (mlxEE[61] & 0xFF00) >> 8;
+    mlxParams.ksTo[2] = mlxEE[62] & 0x00FF;
+    mlxParams.ksTo[3] = (mlxEE[62] & 0xFF00) >> 8;      
+    
+    for(int i = 0; i < 4; i++)
+    {
+        if(mlxParams.ksTo[i] > 127)
+        {
+            mlxParams.ksTo[i] = mlxParams.ksTo[i] - 256;
+        }
+        mlxParams.ksTo[i] = mlxParams.ksTo[i] / KsToScale;
+    } 
+    
+    mlxParams.ksTo[4] = -0.0002f;
+
+    /* CP */
+    float alphaSP[2];
+    int16_t offsetSP[2];
+    float cpKv;
+    float cpKta;
+    uint8_t alphaScaleCp;
+    uint8_t ktaScale1Cp;
+    uint8_t kvScaleCp;
+
+    alphaScaleCp = ((mlxEE[32] & 0xF000) >> 12) + 27;
+    
+    offsetSP[0] = (mlxEE[58] & 0x03FF);
+    if (offsetSP[0] > 511)
+    {
+        offsetSP[0] = offsetSP[0] - 1024;
+    }
+    
+    offsetSP[1] = (mlxEE[58] & 0xFC00) >> 10;
+    if (offsetSP[1] > 31)
+    {
+        offsetSP[1] = offsetSP[1] - 64;
+    }
+    offsetSP[1] = offsetSP[1] + offsetSP[0]; 
+    
+    alphaSP[0] = (mlxEE[57] & 0x03FF);
+    if (alphaSP[0] > 511)
+    {
+        alphaSP[0] = alphaSP[0] - 1024;
+    }
+    alphaSP[0] = ldexpf(alphaSP[0], -alphaScaleCp);
+    
+    alphaSP[1] = (mlxEE[57] & 0xFC00) >> 10;
+    if (alphaSP[1] > 31)
+    {
+        alphaSP[1] = alphaSP[1] - 64;
+    }
+    alphaSP[1] = (1 + alphaSP[1]/128) * alphaSP[0];
+    
+    cpKta = (mlxEE[59] & 0x00FF);
+    if (cpKta > 127)
+    {
+        cpKta = cpKta - 256;
+    }
+    ktaScale1Cp = ((mlxEE[56] & 0x00F0) >> 4) + 8;    
+    mlxParams.cpKta = ldexpf(cpKta, -ktaScale1Cp);
+    
+    cpKv = (mlxEE[59] & 0xFF00) >> 8;
+    if (cpKv > 127)
+    {
+        cpKv = cpKv - 256;
+    }
+    kvScaleCp = (mlxEE[56] & 0x0F00) >> 8;
+    mlxParams.cpKv = ldexpf(cpKv, -kvScaleCp);
+       
+    mlxParams.cpAlpha[0] = alphaSP[0];
+    mlxParams.cpAlpha[1] = alphaSP[1];
+    mlxParams.cpOffset[0] = offsetSP[0];
+    mlxParams.cpOffset[1] = offsetSP[1];
+
+	/* Alpha */
+	int accRow[24];
+    int accColumn[32];
+	float alphaTemp[768];
+
+	const uint8_t accRemScale = mlxEE[32] & 0x000F;
+	const uint8_t accColumnScale = (mlxEE[32] & 0x00F0) >> 4;
+	const uint8_t accRowScale = (mlxEE[32] & 0x0F00) >> 8;
+	uint8_t alphaScale = ((mlxEE[32] & 0xF000) >> 12) + 30;
+	const int alphaRef = mlxEE[33];
+    
+	int p = 0;
+
+	for(int i = 0; i < 6; i++)
+    {
+        p = i * 4;
+        accRow[p + 0] = (mlxEE[34 + i] & 0x000F);
+        accRow[p + 1] = (mlxEE[34 + i] & 0x00F0) >> 4;
+        accRow[p + 2] = (mlxEE[34 + i] & 0x0F00) >> 8;
+        accRow[p + 3] = (mlxEE[34 + i] & 0xF000) >> 12;
+    }
+    
+    for(int i = 0; i < 24; i++)
+    {
+        if (accRow[i] > 7)
+        {
+            accRow[i] = accRow[i] - 16;
+        }
+    }
+    
+    for(int i = 0; i < 8; i++)
+    {
+        p = i * 4;
+        accColumn[p + 0] = (mlxEE[40 + i] & 0x000F);
+        accColumn[p + 1] = (mlxEE[40 + i] & 0x00F0) >> 4;
+        accColumn[p + 2] = (mlxEE[40 + i] & 0x0F00) >> 8;
+        accColumn[p + 3] = (mlxEE[40 + i] & 0xF000) >> 12;
+    }
+    
+    for(int i = 0; i < 32; i ++)
+    {
+        if (accColumn[i] > 7)
+        {
+            accColumn[i] = accColumn[i] - 16;
+        }
+    }
+
+    for(int i = 0; i < 24; i++)
+    {
+        for(int j = 0; j < 32; j ++)
+        {
+            p = 32 * i +j;
+            alphaTemp[p] = (mlxEE[64 + p] & 0x03F0) >> 4;
+            if (alphaTemp[p] > 31)
+            {
+                alphaTemp[p] = alphaTemp[p] - 64;
+            }
+            alphaTemp[p] = alphaTemp[p]*(1 << accRemScale);
+            alphaTemp[p] = (alphaRef + (accRow[i] << accRowScale) + (accColumn[j] << accColumnScale) + alphaTemp[p]);
+            alphaTemp[p] = ldexpf(alphaTemp[p], -alphaScale);
+            alphaTemp[p] = alphaTemp[p] - mlxParams.tgc * (mlxParams.cpAlpha[0] + mlxParams.cpAlpha[1])/2;
+            alphaTemp[p] = SCALEALPHA/alphaTemp[p];
+        }
+    }
+
+	float temp = alphaTemp[0];
+    for(int i = 1; i < 768; i++)
+    {
+        if (alphaTemp[i] > temp)
+        {
+            temp = alphaTemp[i];
+        }
+    }
+
+	alphaScale = 0;
+    while(temp < 32768)
+    {
+        temp = temp*2;
+        alphaScale = alphaScale + 1;
+    } 
+    
+    for(int i = 0; i < 768; i++)
+    {
+        temp = ldexpf(alphaTemp[i], alphaScale);        
+        mlxParams.alpha[i] = (uint16_t)(temp + 0.5f);        
+        
+    } 
+
+    mlxParams.alphaScale = alphaScale;
+
+	/* Offset */
+	int occRow[24];
+    int occColumn[32];
+    int po = 0;
+
+	const uint8_t occRemScale = (mlxEE[16] & 0x000F);
+	const uint8_t occColumnScale = (mlxEE[16] & 0x00F0) >> 4;
+	const uint8_t occRowScale = (mlxEE[16] & 0x0F00) >> 8;
+    const int16_t offsetRef = (int16_t)mlxEE[17];
+    
+    for(int i = 0; i < 6; i++)
+    {
+        po = i * 4;
+        occRow[po + 0] = (mlxEE[18 + i] & 0x000F);
+        occRow[po + 1] = (mlxEE[18 + i] & 0x00F0) >> 4;
+        occRow[po + 2] = (mlxEE[18 + i] & 0x0F00) >> 8;
+        occRow[po + 3] = (mlxEE[18 + i] & 0xF000) >> 12;
+    }
+    
+    for(int i = 0; i < 24; i++)
+    {
+        if (occRow[i] > 7)
+        {
+            occRow[i] = occRow[i] - 16;
+        }
+    }
+    
+    for(int i = 0; i < 8; i++)
+    {
+        po = i * 4;
+        occColumn[po + 0] = (mlxEE[24 + i] & 0x000F);
+        occColumn[po + 1] = (mlxEE[24 + i] & 0x00F0) >> 4;
+        occColumn[po + 2] = (mlxEE[24 + i] & 0x0F00) >> 8;
+        occColumn[po + 3] = (mlxEE[24 + i] & 0xF000) >> 12;
+    }
+    
+    for(int i = 0; i < 32; i ++)
+    {
+        if (occColumn[i] > 7)
+        {
+            occColumn[i] = occColumn[i] - 16;
+        }
+    }
+
+    for(int i = 0; i < 24; i++)
+    {
+        for(int j = 0; j < 32; j ++)
+        {
+            po = 32 * i +j;
+            mlxParams.offset[po] = (mlxEE[64 + po] & 0xFC00) >> 10;
+            if (mlxParams.offset[po] > 31)
+            {
+                mlxParams.offset[po] = mlxParams.offset[po] - 64;
+            }
+            mlxParams.offset[po] = mlxParams.offset[po]*(1 << occRemScale);
+            mlxParams.offset[po] = (offsetRef + (occRow[i] << occRowScale) + (occColumn[j] << occColumnScale) + mlxParams.offset[po]);
+        }
+    }
+
+	/* KtaPixel */
+	int pkp = 0;
+    int8_t KtaRC[4];
+    int8_t KtaRoCo;
+    int8_t KtaRoCe;
+    int8_t KtaReCo;
+    int8_t KtaReCe;
+    uint8_t ktaScale1;
+    uint8_t ktaScale2;
+    uint8_t split;
+    float ktaTemp[768];
+    float tempKta;
+    
+    KtaRoCo = (int8_t)((mlxEE[54] & 0xFF00) >> 8);
+    KtaRC[0] = KtaRoCo;
+    
+    KtaReCo = (int8_t)((mlxEE[54] & 0x00FF));
+    KtaRC[2] = KtaReCo;
+      
+    KtaRoCe = (int8_t)((mlxEE[55] & 0xFF00) >> 8);
+    KtaRC[1] = KtaRoCe;
+      
+    KtaReCe = (int8_t)((mlxEE[55] & 0x00FF));
+    KtaRC[3] = KtaReCe;
+  
+    ktaScale1 = ((mlxEE[56] & 0x00F0) >> 4) + 8;
+    ktaScale2 = (mlxEE[56] & 0x000F);
+
+    for(int i = 0; i < 24; i++)
+    {
+        for(int j = 0; j < 32; j ++)
+        {
+            pkp = 32 * i +j;
+            split = 2*(pkp/32 - (pkp/64)*2) + pkp % 2;
+            ktaTemp[pkp] = (mlxEE[64 + pkp] & 0x000E) >> 1;
+            if (ktaTemp[pkp] > 3)
+            {
+                ktaTemp[pkp] = ktaTemp[pkp] - 8;
+            }
+            ktaTemp[pkp] = ktaTemp[pkp] * (1 << ktaScale2);
+            ktaTemp[pkp] = KtaRC[split] + ktaTemp[pkp];
+            ktaTemp[pkp] = ldexpf(ktaTemp[pkp], -ktaScale1);
+        }
+    }
+    
+    tempKta = fabsf(ktaTemp[0]);
+    for(int i = 1; i < 768; i++)
+    {
+        if (fabsf(ktaTemp[i]) > tempKta)
+        {
+            tempKta = fabsf(ktaTemp[i]);
+        }
+    }
+    
+    ktaScale1 = 0;
+    while(tempKta < 64)
+    {
+        tempKta = tempKta*2;
+        ktaScale1 = ktaScale1 + 1;
+    }    
+     
+    for(int i = 0; i < 768; i++)
+    {
+        tempKta = ldexpf(ktaTemp[i], ktaScale1);
+        if (tempKta < 0)
+        {
+            mlxParams.kta[i] = (int8_t)(tempKta - 0.5f);
+        }
+        else
+        {
+            mlxParams.kta[i] = (int8_t)(tempKta + 0.5f);
+        }        
+        
+    } 
+    
+    mlxParams.ktaScale = ktaScale1;
+
+    /* KvPixel */
+    int pKvp = 0;
+    int8_t KvT[4];
+    int8_t KvRoCo;
+    int8_t KvRoCe;
+    int8_t KvReCo;
+    int8_t KvReCe;
+    uint8_t kvScale;
+    uint8_t splitKvp;
+    float kvTemp[768];
+    float tempKvp;
+
+    KvRoCo = (mlxEE[52] & 0xF000) >> 12;
+    if (KvRoCo > 7)
+    {
+        KvRoCo = KvRoCo - 16;
+    }
+    KvT[0] = KvRoCo;
+    
+    KvReCo = (mlxEE[52] & 0x0F00) >> 8;
+    if (KvReCo > 7)
+    {
+        KvReCo = KvReCo - 16;
+    }
+    KvT[2] = KvReCo;
+      
+    KvRoCe = (mlxEE[52] & 0x00F0) >> 4;
+    if (KvRoCe > 7)
+    {
+        KvRoCe = KvRoCe - 16;
+    }
+    KvT[1] = KvRoCe;
+      
+    KvReCe = (mlxEE[52] & 0x000F);
+    if (KvReCe > 7)
+    {
+        KvReCe = KvReCe - 16;
+    }
+    KvT[3] = KvReCe;
+  
+    kvScale = (mlxEE[56] & 0x0F00) >> 8;
+
+
+    for(int i = 0; i < 24; i++)
+    {
+        for(int j = 0; j < 32; j ++)
+        {
+            pKvp = 32 * i +j;
+            splitKvp = 2*(pKvp/32 - (pKvp/64)*2) + pKvp%2;
+            kvTemp[pKvp] = KvT[splitKvp];
+            kvTemp[pKvp] = ldexpf(kvTemp[pKvp], -kvScale);
+        }
+    }
+    
+    tempKvp = fabsf(kvTemp[0]);
+    for(int i = 1; i < 768; i++)
+    {
+        if (fabsf(kvTemp[i]) > tempKvp)
+        {
+            tempKvp = fabsf(kvTemp[i]);
+        }
+    }
+    
+    kvScale = 0;
+    while(tempKvp < 64)
+    {
+        tempKvp = tempKvp*2;
+        kvScale = kvScale + 1;
+    }    
+     
+    for(int i = 0; i < 768; i++)
+    {
+        tempKvp = ldexpf(kvTemp[i], kvScale);
+        if (tempKvp < 0)
+        {
+            mlxParams.kv[i] = (int8_t)(tempKvp - 0.5f);
+        }
+        else
+        {
+            mlxParams.kv[i] = (int8_t)(tempKvp + 0.5f);
+        }        
+        
+    } 
+    
+    mlxParams.kvScale = kvScale;
+
+    /* CILC */
+    float ilChessC[3];
+    uint8_t calibrationModeEE;
+    
+    calibrationModeEE = (mlxEE[10] & 0x0800) >> 11;
+    calibrationModeEE = calibrationModeEE ^ 0x01;
+
+    ilChessC[0] = (mlxEE[53] & 0x003F);
+    if (ilChessC[0] > 31)
+    {
+        ilChessC[0] = ilChessC[0] - 64;
+    }
+    ilChessC[0] = ilChessC[0] / 16.0f;
+    
+    ilChessC[1] = (mlxEE[53] & 0x07C0) >> 6;
+    if (ilChessC[1] > 15)
+    {
+        ilChessC[1] = ilChessC[1] - 32;
+    }
+    ilChessC[1] = ilChessC[1] / 2.0f;
+    
+    ilChessC[2] = (mlxEE[53] & 0xF800) >> 11;
+    if (ilChessC[2] > 15)
+    {
+        ilChessC[2] = ilChessC[2] - 32;
+    }
+    ilChessC[2] = ilChessC[2] / 8.0f;
+    
+    mlxParams.calibrationModeEE = calibrationModeEE;
+    mlxParams.ilChessC[0] = ilChessC[0];
+    mlxParams.ilChessC[1] = ilChessC[1];
+    mlxParams.ilChessC[2] = ilChessC[2];
+
+    /* Deviation pixels */
+    uint16_t pixCnt = 0;
+    uint16_t brokenPixCnt = 0;
+    uint16_t outlierPixCnt = 0;
+    
+    for(pixCnt = 0; pixCnt<20; pixCnt++)
+    {
+        mlxParams.brokenPixels[pixCnt] = 0xFFFF;
+        mlxParams.outlierPixels[pixCnt] = 0xFFFF;
+    }
+        
+    pixCnt = 0;    
+    while (pixCnt < 768 && brokenPixCnt < 20 && outlierPixCnt < 20)
+    {
+        if(mlxEE[pixCnt+64] == 0)
+        {
+            mlxParams.brokenPixels[brokenPixCnt] = pixCnt;
+            brokenPixCnt = brokenPixCnt + 1;
+        }    
+        else if((mlxEE[pixCnt+64] & 0x0001) != 0)
+        {
+            mlxParams.outlierPixels[outlierPixCnt] = pixCnt;
+            outlierPixCnt = outlierPixCnt + 1;
+        }    
+        pixCnt++;
+        
+    } 
+}
+
+/* MLX90640_CalculateTo for one subpage of host-order frame RAM, reflected temperature Ta - OPENAIR_TA_SHIFT.
+   Writes only the pixels the subpage updated. */
+reference_ambient_t referenceCalculateTo(const paramsMLX90640_t& params, const uint16_t* frame, const uint16_t control,
+	const uint8_t subPage, const double emissivity, double* to)
+{
+	reference_ambient_t ambient;
+	const int resolutionRAM = (control & 0x0C00) >> 10;
+	const double resolutionCorrection = pow(2, (double)params.resolutionEE) / pow(2, (double)resolutionRAM);
+	ambient.vdd = (resolutionCorrection * (int16_t)frame[810] - params.vdd25) / params.kVdd + 3.3;
+
+	const double ptat = (int16_t)frame[800];
+	const double ptatArt = (ptat / (ptat * params.alphaPTAT + (int16_t)frame[768])) * pow(2, 18.0);
+	ambient.ta = (ptatArt / (1 + params.KvPTAT * (ambient.vdd - 3.3)) - params.vPTAT25) / params.KtPTAT + 25;
+	const double ta = ambient.ta;
+	const double vdd = ambient.vdd;
+	const double tr = ta - OPENAIR_TA_SHIFT;
+
+	const double ta4 = pow(ta + 273.15, 4);
+	const double tr4 = pow(tr + 273.15, 4);
+	const double taTr = tr4 - (tr4 - ta4) / emissivity;
+
+	double alphaCorrR[4];
+	alphaCorrR[0] = 1 / (1 + params.ksTo[0] * 40);
+	alphaCorrR[1] = 1;
+	alphaCorrR[2] = 1 + params.ksTo[1] * params.ct[2];
+	alphaCorrR[3] = alphaCorrR[2] * (1 + params.ksTo[2] * (params.ct[3] - params.ct[2]));
+
+	const double gain = params.gainEE / (double)(int16_t)frame[778];
+	const uint8_t mode = (control & 0x1000) >> 12;
+	const double cpOffsetComp = (1 + params.cpKta * (ta - 25)) * (1 + params.cpKv * (vdd - 3.3));
+	double irDataCP[2];
+	irDataCP[0] = (int16_t)frame[776] * gain - params.cpOffset[0] * cpOffsetComp;
+	if (mode == params.calibrationModeEE)
+	{
+		irDataCP[1] = (int16_t)frame[808] * gain - params.cpOffset[1] * cpOffsetComp;
+	}
+	else
+	{
+		irDataCP[1] = (int16_t)frame[808] * gain - (params.cpOffset[1] + params.ilChessC[0]) * cpOffsetComp;
+	}
+
+	for (int pixelNumber = 0; pixelNumber < 768; pixelNumber++)
+	{
+		const int ilPattern = pixelNumber / 32 - (pixelNumber / 64) * 2;
+		const int chessPattern = ilPattern ^ (pixelNumber - (pixelNumber / 2) * 2);
+		const int conversionPattern = ((pixelNumber + 2) / 4 - (pixelNumber + 3) / 4 + (pixelNumber + 1) / 4 - pixelNumber / 4) * (1 - 2 * ilPattern);
+		const int pattern = (mode == 0) ? ilPattern : chessPattern;
+		if (pattern != subPage)
+		{
+			continue;
+		}
+
+		const double kta = params.kta[pixelNumber] / pow(2, (double)params.ktaScale);
+		const double kv = params.kv[pixelNumber] / pow(2, (double)params.kvScale);
+		double irData = (int16_t)frame[pixelNumber] * gain;
+		irData = irData - params.offset[pixelNumber] * (1 + kta * (ta - 25)) * (1 + kv * (vdd - 3.3));
+		if (mode != params.calibrationModeEE)
+		{
+			irData = irData + params.ilChessC[2] * (2 * ilPattern - 1) - params.ilChessC[1] * conversionPattern;
+		}
+		irData = irData - params.tgc * irDataCP[subPage];
+		irData = irData / emissivity;
+
+		double alphaCompensated = SCALEALPHA * pow(2, (double)params.alphaScale) / params.alpha[pixelNumber];
+		alphaCompensated = alphaCompensated * (1 + params.KsTa * (ta - 25));
+
+		double Sx = alphaCompensated * alphaCompensated * alphaCompensated * (irData + alphaCompensated * taTr);
+		Sx = sqrt(sqrt(Sx)) * params.ksTo[1];
+		double To = sqrt(sqrt(irData / (alphaCompensated * (1 - params.ksTo[1] * 273.15) + Sx) + taTr)) - 273.15;
+
+		int range;
+		if (To < params.ct[1])
+		{
+			range = 0;
+		}
+		else if (To < params.ct[2])
+		{
+			range = 1;
+		}
+		else if (To < params.ct[3])
+		{
+			range = 2;
+		}
+		else
+		{
+			range = 3;
+		}
+		to[pixelNumber] = sqrt(sqrt(irData / (alphaCompensated * alphaCorrR[range] * (1 + params.ksTo[range] * (To - params.ct[range]))) + taTr)) - 273.15;
+	}
+	return ambient;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#ifndef __REFERENCE_MLX90640_H
+#define __REFERENCE_MLX90640_H
+
+#include <stdint.h>
+#include <mlx90640.h>
+
+/** Ambient values of one subpage */
+typedef struct {
+	double vdd;
+	double ta;
+} reference_ambient_t;
+
+void referenceConvertEE(const uint16_t* mlxEE, paramsMLX90640_t& mlxParams);
+reference_ambient_t referenceCalculateTo(const paramsMLX90640_t& params, const uint16_t* frame, uint16_t control, uint8_t subPage,
+	double emissivity, double* to);
+
+#endif /* __REFERENCE_MLX90640_H */
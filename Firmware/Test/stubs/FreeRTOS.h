@@ -0,0 +1,21 @@
+#pragma once
+#ifndef __FREERTOS_H
+#define __FREERTOS_H
+
+/* Host stand-in for the FreeRTOS types and macros the sensor code uses, 1 ms ticks like FreeRTOSConfig.h */
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY 0xFFFFFFFFu
+#define configMINIMAL_STACK_SIZE 128
+#define portYIELD_FROM_ISR(x) (void)(x)
+
+#endif /* __FREERTOS_H */
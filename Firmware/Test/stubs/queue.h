@@ -0,0 +1,13 @@
+#pragma once
+#ifndef __QUEUE_H
+#define __QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef void* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout);
+
+#endif /* __QUEUE_H */
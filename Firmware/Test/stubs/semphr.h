@@ -0,0 +1,13 @@
+#pragma once
+#ifndef __SEMPHR_H
+#define __SEMPHR_H
+
+#include "queue.h"
+
+typedef void* SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif /* __SEMPHR_H */
@@ -0,0 +1,23 @@
+#pragma once
+#ifndef __STM32F429I_DISCOVERY_H
+#define __STM32F429I_DISCOVERY_H
+
+/* The I2C3 link functions of the BSP, answered by the mock sensor */
+#include "stm32f4xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint8_t I2Cx_WriteData16(uint8_t Addr, uint16_t Reg, uint16_t Value);
+uint8_t I2Cx_ReadBuffer16(uint8_t Addr, uint16_t Reg, uint16_t* pBuffer, uint16_t Length);
+uint8_t I2Cx_ReadBuffer16DMA(uint8_t Addr, uint16_t Reg, uint16_t* pBuffer, uint16_t Length);
+uint8_t I2Cx_ReadBuffer(uint8_t Addr, uint8_t Reg, uint8_t* pBuffer, uint16_t Length);
+uint8_t I2Cx_WriteBuffer(uint8_t Addr, uint8_t Reg, uint8_t* pBuffer, uint16_t Length);
+uint8_t I2Cx_BusClear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F429I_DISCOVERY_H */
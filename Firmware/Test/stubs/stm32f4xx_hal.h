@@ -0,0 +1,67 @@
+#pragma once
+#ifndef __STM32F4xx_HAL_H
+#define __STM32F4xx_HAL_H
+
+/* Host stand-in for the parts of the HAL and CMSIS core the sensor code touches */
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef struct {
+	int unused;
+} DMA2D_HandleTypeDef;
+
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type* const DWT;
+extern CoreDebug_Type* const CoreDebug;
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+static inline uint32_t __REV16(const uint32_t value)
+{
+	return ((value & 0xFF00FF00u) >> 8) | ((value & 0x00FF00FFu) << 8);
+}
+
+static inline int16_t __REVSH(const int16_t value)
+{
+	return (int16_t)__builtin_bswap16((uint16_t)value);
+}
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+
+typedef struct {
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS 0x00000000U
+#define FLASH_BANK_2 2U
+#define FLASH_SECTOR_23 23U
+#define FLASH_VOLTAGE_RANGE_3 0x00000002U
+#define FLASH_TYPEPROGRAM_WORD 0x00000002U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* sectorError);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t typeProgram, uint32_t address, uint64_t data);
+
+#endif /* __STM32F4xx_HAL_H */
@@ -0,0 +1,21 @@
+#pragma once
+#ifndef __TASK_H
+#define __TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+
+#define taskSCHEDULER_SUSPENDED 0
+#define taskSCHEDULER_NOT_STARTED 1
+#define taskSCHEDULER_RUNNING 2
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskGetSchedulerState(void);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+
+#endif /* __TASK_H */
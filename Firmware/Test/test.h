@@ -0,0 +1,35 @@
+#pragma once
+#ifndef __TEST_H
+#define __TEST_H
+
+/* Minimal check macros, a test binary exits non-zero if any check failed */
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_BELOW(value, limit) \
+	do { \
+		const double checkValue = (value); \
+		if (!(checkValue < (limit))) \
+		{ \
+			printf("%s:%d: %s = %g, expected below %g\n", __FILE__, __LINE__, #value, checkValue, (double)(limit)); \
+			testFailures++; \
+		} \
+	} while (0)
+
+static inline int testResult(const char* name)
+{
+	printf("%s: %s\n", name, testFailures ? "FAILED" : "passed");
+	return testFailures ? 1 : 0;
+}
+
+#endif /* __TEST_H */
@@ -0,0 +1,512 @@
+/* Host timings of the sensor pipeline on replayed subpages. DWT->CYCCNT is a stub on the host, so
+   every timing is wall time from the best of BENCH_REPEATS runs, which keeps the ratios meaningful
+   even though the absolute numbers are not the target's. */
+#include "test.h"
+#include "mock_sensor.h"
+#include "reference_mlx90640.h"
+#include <thermal.h>
+#include <chrono>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_SUBPAGES 64
+#define BENCH_REPEATS 20
+#define BENCH_EMISSIVITY 0.95f
+#define BENCH_MAX_DIFF_K 0.01 ///< float loops of the same equation, on every pixel either updates
+#define BENCH_EE_IMAGES 16
+#define BENCH_READ_IMAGE_MAX_US 100 ///< mock bus read plus the whole subpage pipeline, 17 us measured
+
+/* Exposes the specialized To kernels to the dispatch benchmark */
+class BenchSensor : public IRSensor
+{
+public:
+	typedef void (IRSensor::*Kernel)(const to_frame_params_t& frame);
+	static const Kernel subPage1Kernels[2][2];
+};
+
+/* Exact solver kernels of subpage 1, [readout mode][mode matches calibration] */
+const BenchSensor::Kernel BenchSensor::subPage1Kernels[2][2] = {
+	{ &BenchSensor::calculateTempMapKernel<TO_SOLVER_EXACT, MLX90640_INTERLEAVED, false, 1>,
+	  &BenchSensor::calculateTempMapKernel<TO_SOLVER_EXACT, MLX90640_INTERLEAVED, true, 1> },
+	{ &BenchSensor::calculateTempMapKernel<TO_SOLVER_EXACT, MLX90640_CHESS, false, 1>,
+	  &BenchSensor::calculateTempMapKernel<TO_SOLVER_EXACT, MLX90640_CHESS, true, 1> }
+};
+
+static I2CBus bus;
+static BenchSensor sensor;
+static paramsMLX90640_t reference;
+static float baselineMap[768];
+static uint16_t runtimeFrame[832]; ///< big-endian, as the DMA leaves frame RAM
+static float runtimeOffset[768];
+static float runtimeAlpha[768];
+static float runtimeIlChessCorr[768];
+static bool runtimeBad[768];
+static float runtimeMap[768];
+static temp_stats_t runtimeStats;
+
+/* Shortest of BENCH_REPEATS runs of body, in microseconds */
+template <typename Body>
+static double bestMicros(Body body)
+{
+	double best = INFINITY;
+	for (int r = 0; r < BENCH_REPEATS; r++)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		best = fmin(best, elapsed.count());
+	}
+	return best;
+}
+
+static bool isBadPixel(const uint16_t pixel)
+{
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		if (reference.brokenPixels[i] == pixel || reference.outlierPixels[i] == pixel)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* calculateTempMap before the kernel rewrite: every pixel tests its pattern, rescales kta, kv and
+   alpha and recompensates its offset. Only the readout mode shift is fixed, it read 0x1000 >> 5. */
+static void baselineTempMap(const paramsMLX90640_t& params, const uint16_t* frameData, const uint16_t control,
+	const uint8_t subPage, const float ta, const float vdd, const float emissivity, const float tr, float* dots)
+{
+	float irDataCP[2];
+	int8_t pattern;
+	float alphaCorrR[4];
+    int8_t range;
+
+    float ta4 = (ta + 273.15f);
+    ta4 = ta4 * ta4;
+    ta4 = ta4 * ta4;
+    float tr4 = (tr + 273.15f);
+    tr4 = tr4 * tr4;
+    tr4 = tr4 * tr4;
+	const float taTr = tr4 - (tr4 - ta4) / emissivity;
+
+	const float ktaScale = pow(2, (double)params.ktaScale);
+	const float kvScale = pow(2, (double)params.kvScale);
+	const float alphaScale = pow(2, (double)params.alphaScale);
+
+    alphaCorrR[0] = 1 / (1 + params.ksTo[0] * 40);
+    alphaCorrR[1] = 1 ;
+    alphaCorrR[2] = (1 + params.ksTo[1] * params.ct[2]);
+    alphaCorrR[3] = alphaCorrR[2] * (1 + params.ksTo[2] * (params.ct[3] - params.ct[2]));
+
+    float gain = frameData[778];
+    if(gain > 32767)
+    {
+        gain = gain - 65536;
+    }
+
+    gain = params.gainEE / gain;
+
+	const uint8_t mode = (control & 0x1000) >> 12;
+
+    irDataCP[0] = frameData[776];
+    irDataCP[1] = frameData[808];
+    for( int i = 0; i < 2; i++)
+    {
+        if(irDataCP[i] > 32767)
+        {
+            irDataCP[i] = irDataCP[i] - 65536;
+        }
+        irDataCP[i] = irDataCP[i] * gain;
+    }
+    irDataCP[0] = irDataCP[0] - params.cpOffset[0] * (1 + params.cpKta * (ta - 25)) * (1 + params.cpKv * (vdd - 3.3));
+    if( mode ==  params.calibrationModeEE)
+    {
+        irDataCP[1] = irDataCP[1] - params.cpOffset[1] * (1 + params.cpKta * (ta - 25)) * (1 + params.cpKv * (vdd - 3.3));
+    }
+    else
+    {
+      irDataCP[1] = irDataCP[1] - (params.cpOffset[1] + params.ilChessC[0]) * (1 + params.cpKta * (ta - 25)) * (1 + params.cpKv * (vdd - 3.3));
+    }
+
+    for(uint16_t pixelNumber = 0; pixelNumber < 768; pixelNumber++)
+    {
+	    const int8_t ilPattern = pixelNumber / 32 - (pixelNumber / 64) * 2;
+	    const int8_t chessPattern = ilPattern ^ (pixelNumber - (pixelNumber / 2) * 2);
+	    const int8_t conversionPattern = ((pixelNumber + 2) / 4 - (pixelNumber + 3) / 4 + (pixelNumber + 1) / 4 - pixelNumber / 4) * (1 - 2 * ilPattern);
+
+        if(mode == 0)
+        {
+          pattern = ilPattern;
+        }
+        else
+        {
+          pattern = chessPattern;
+        }
+
+        if(pattern == subPage)
+        {
+            float irData = frameData[pixelNumber];
+            if(irData > 32767)
+            {
+                irData = irData - 65536;
+            }
+            irData = irData * gain;
+
+            const float kta = params.kta[pixelNumber] / ktaScale;
+            const float kv = params.kv[pixelNumber] / kvScale;
+            irData = irData - params.offset[pixelNumber]*(1 + kta*(ta - 25))*(1 + kv*(vdd - 3.3));
+
+            if(mode !=  params.calibrationModeEE)
+            {
+              irData = irData + params.ilChessC[2] * (2 * ilPattern - 1) - params.ilChessC[1] * conversionPattern;
+            }
+
+            irData = irData - params.tgc * irDataCP[subPage];
+            irData = irData / emissivity;
+
+            float alphaCompensated = SCALEALPHA * alphaScale / params.alpha[pixelNumber];
+            alphaCompensated = alphaCompensated*(1 + params.KsTa * (ta - 25));
+
+            float Sx = alphaCompensated * alphaCompensated * alphaCompensated * (irData + alphaCompensated * taTr);
+            Sx = sqrt(sqrt(Sx)) * params.ksTo[1];
+
+            float To = sqrt(sqrt(irData / (alphaCompensated * (1 - params.ksTo[1] * 273.15) + Sx) + taTr)) - 273.15;
+
+            if(To < params.ct[1])
+            {
+                range = 0;
+            }
+            else if(To < params.ct[2])
+            {
+                range = 1;
+            }
+            else if(To < params.ct[3])
+            {
+                range = 2;
+            }
+            else
+            {
+                range = 3;
+            }
+
+            To = sqrt(sqrt(irData / (alphaCompensated * alphaCorrR[range] * (1 + params.ksTo[range] * (To - params.ct[range]))) + taTr)) - 273.15;
+
+            dots[pixelNumber] = To;
+        }
+    }
+}
+
+/* Reads subpage n through the sensor and returns the ambient the reference solves it with */
+static reference_ambient_t readSubPage(const int n)
+{
+	static double to[768];
+	mockFillFrame(n & 1, n);
+	CHECK(sensor.readImage(BENCH_EMISSIVITY));
+	return referenceCalculateTo(reference, mockFrameRam(), mockControl(), n & 1, BENCH_EMISSIVITY, to);
+}
+
+/* Old per-pixel loop against calculateTempMap on the same subpages, both in chess and interleaved */
+static void benchmarkTempMap()
+{
+	const mlx90640_mode_t modes[2] = { MLX90640_CHESS, MLX90640_INTERLEAVED };
+	for (uint8_t m = 0; m < 2; m++)
+	{
+		sensor.setMlxMode(modes[m]);
+		double baselineMicros = 0;
+		double kernelMicros = 0;
+		double worst = 0;
+		for (int n = 0; n < BENCH_SUBPAGES; n++)
+		{
+			const reference_ambient_t ambient = readSubPage(n);
+			const uint16_t* frame = mockFrameRam();
+			const uint16_t control = mockControl();
+			const float ta = (float)ambient.ta;
+			const float vdd = (float)ambient.vdd;
+			const float tr = ta - OPENAIR_TA_SHIFT;
+			baselineMicros += bestMicros([&] { baselineTempMap(reference, frame, control, n & 1, ta, vdd, BENCH_EMISSIVITY, tr, baselineMap); });
+			kernelMicros += bestMicros([&] { sensor.calculateTempMap(BENCH_EMISSIVITY, tr); });
+			for (uint16_t i = 0; i < 768; i++)
+			{
+				if (!isBadPixel(i))
+				{
+					worst = fmax(worst, fabs(sensor.getTempMap()[i] - baselineMap[i]));
+				}
+			}
+		}
+		baselineMicros /= BENCH_SUBPAGES;
+		kernelMicros /= BENCH_SUBPAGES;
+		printf("%s: old per-pixel loop %.1f us per subpage, calculateTempMap %.1f us per subpage, %.1fx, max difference %.2e K\n",
+			modes[m] == MLX90640_CHESS ? "chess" : "interleaved", baselineMicros, kernelMicros, baselineMicros / kernelMicros, worst);
+		CHECK_BELOW(worst, BENCH_MAX_DIFF_K);
+		CHECK_BELOW(kernelMicros, baselineMicros);
+	}
+}
+
+/* The tables calculateTempMapKernel reads, at the Ta and Vdd of the subpage */
+static void buildRuntimeTables(const float ta, const float vdd)
+{
+	const float alphaNumerator = ldexpf(SCALEALPHA, reference.alphaScale);
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		const int8_t ilPattern = (i / 32) & 1;
+		const int8_t conversionPattern = ((i + 2) / 4 - (i + 3) / 4 + (i + 1) / 4 - i / 4) * (1 - 2 * ilPattern);
+		const float kta = ldexpf(reference.kta[i], -reference.ktaScale);
+		const float kv = ldexpf(reference.kv[i], -reference.kvScale);
+		runtimeOffset[i] = reference.offset[i] * (1 + kta * (ta - 25)) * (1 + kv * (vdd - 3.3f));
+		runtimeAlpha[i] = alphaNumerator / reference.alpha[i];
+		runtimeIlChessCorr[i] = reference.ilChessC[2] * (2 * ilPattern - 1) - reference.ilChessC[1] * conversionPattern;
+		runtimeBad[i] = isBadPixel(i);
+	}
+}
+
+/* calculateTempMapKernel without specialization: the loop runs over all 768 pixels and tests the
+   pattern, readout mode and calibration match of each, on the same tables and with the same stats */
+static void runtimeBranchTempMap(const to_frame_params_t& frame, const mlx90640_mode_t mode, const bool calibrationMatch,
+	const uint8_t subPage)
+{
+    float minTo = 1000;
+    float maxTo = -100;
+    float sumTo = 0;
+    uint16_t minIndex = 0;
+    uint16_t maxIndex = 0;
+    uint16_t count = 0;
+    memset(runtimeStats.hist, 0, sizeof(runtimeStats.hist));
+
+    for(uint16_t pixelNumber = 0; pixelNumber < 768; pixelNumber++)
+    {
+        const int8_t ilPattern = pixelNumber / 32 - (pixelNumber / 64) * 2;
+        const int8_t chessPattern = ilPattern ^ (pixelNumber - (pixelNumber / 2) * 2);
+        const int8_t pattern = (mode == MLX90640_CHESS) ? chessPattern : ilPattern;
+        if(pattern != subPage)
+        {
+            continue;
+        }
+
+        float irData = (int16_t)__REVSH((int16_t)runtimeFrame[pixelNumber]);
+        irData = irData * frame.gain;
+        irData = irData - runtimeOffset[pixelNumber];
+        if(!calibrationMatch)
+        {
+            irData = irData + runtimeIlChessCorr[pixelNumber];
+        }
+        irData = irData - frame.cpCorrection;
+        irData = irData / frame.emissivity;
+
+        const float alphaCompensated = runtimeAlpha[pixelNumber] * frame.alphaTaCorr;
+        float Sx = alphaCompensated * alphaCompensated * alphaCompensated * (irData + alphaCompensated * frame.taTr);
+        Sx = sqrtf(sqrtf(Sx)) * reference.ksTo[1];
+        float To = sqrtf(sqrtf(irData / (alphaCompensated * frame.ksTo1Corr + Sx) + frame.taTr)) - 273.15f;
+        int8_t range;
+        if(To < reference.ct[1])
+        {
+            range = 0;
+        }
+        else if(To < reference.ct[2])
+        {
+            range = 1;
+        }
+        else if(To < reference.ct[3])
+        {
+            range = 2;
+        }
+        else
+        {
+            range = 3;
+        }
+        To = sqrtf(sqrtf(irData / (alphaCompensated * frame.alphaCorrR[range] * (1 + reference.ksTo[range] * (To - reference.ct[range]))) + frame.taTr)) - 273.15f;
+        runtimeMap[pixelNumber] = To;
+
+        if(runtimeBad[pixelNumber])
+        {
+            continue;
+        }
+        count++;
+        if(To < minTo)
+        {
+            minTo = To;
+            minIndex = pixelNumber;
+        }
+        if(To > maxTo)
+        {
+            maxTo = To;
+            maxIndex = pixelNumber;
+        }
+        sumTo = sumTo + To;
+
+        const float bin = (To - TEMP_HIST_MIN) * (1.0f / TEMP_HIST_BIN_WIDTH);
+        if(bin <= 0)
+        {
+            runtimeStats.hist[0]++;
+        }
+        else if(bin >= TEMP_HIST_BINS - 1)
+        {
+            runtimeStats.hist[TEMP_HIST_BINS - 1]++;
+        }
+        else
+        {
+            runtimeStats.hist[(uint8_t)bin]++;
+        }
+    }
+
+    runtimeStats.min = minTo;
+    runtimeStats.max = maxTo;
+    runtimeStats.sum = sumTo;
+    runtimeStats.minIndex = minIndex;
+    runtimeStats.maxIndex = maxIndex;
+    runtimeStats.count = count;
+}
+
+/* The kernel tempMapKernels dispatches to against the loop that branches per pixel, on the
+   subpage 1 half of each frame so the published frame carries its to_frame_params_t */
+static void benchmarkDispatch()
+{
+	const mlx90640_mode_t modes[2] = { MLX90640_CHESS, MLX90640_INTERLEAVED };
+	for (uint8_t m = 0; m < 2; m++)
+	{
+		sensor.setMlxMode(modes[m]);
+		double kernelMicros = 0;
+		double runtimeMicros = 0;
+		double worst = 0;
+		for (int n = 0; n < BENCH_SUBPAGES; n++)
+		{
+			readSubPage(n);
+			if ((n & 1) == 0)
+			{
+				continue;
+			}
+			const thermal_frame_t* latest = sensor.getLatestFrame();
+			buildRuntimeTables(latest->ta, latest->vdd);
+			for (uint16_t i = 0; i < 832; i++)
+			{
+				runtimeFrame[i] = (uint16_t)__REVSH((int16_t)mockFrameRam()[i]);
+			}
+			const mlx90640_mode_t mode = (mlx90640_mode_t)((mockControl() & 0x1000) >> 12);
+			const bool calibrationMatch = (mode == reference.calibrationModeEE);
+			const BenchSensor::Kernel kernel = BenchSensor::subPage1Kernels[mode][calibrationMatch];
+			kernelMicros += bestMicros([&] { (sensor.*kernel)(latest->params); });
+			runtimeMicros += bestMicros([&] { runtimeBranchTempMap(latest->params, mode, calibrationMatch, 1); });
+			for (uint16_t i = 0; i < 768; i++)
+			{
+				const int8_t ilPattern = (i / 32) & 1;
+				if (((mode == MLX90640_CHESS) ? (ilPattern ^ (i & 1)) : ilPattern) == 1)
+				{
+					worst = fmax(worst, fabs(sensor.getTempMap()[i] - runtimeMap[i]));
+				}
+			}
+		}
+		kernelMicros /= BENCH_SUBPAGES / 2;
+		runtimeMicros /= BENCH_SUBPAGES / 2;
+		printf("%s: runtime-branch loop %.1f us per subpage, specialized kernel %.1f us per subpage, %.1fx, max difference %.2e K\n",
+			modes[m] == MLX90640_CHESS ? "chess" : "interleaved", runtimeMicros, kernelMicros, runtimeMicros / kernelMicros, worst);
+		CHECK_BELOW(worst, BENCH_MAX_DIFF_K);
+		CHECK_BELOW(kernelMicros, runtimeMicros);
+	}
+}
+
+/* calculateTempMap in every To solver on the same subpages, the LUT table is built by the first runs.
+   The host's sqrtss is as cheap as a multiply, so only the LUT is expected to beat the exact solver
+   here, the fast and table seeds are reported for comparison with the target's DWT figures. */
+static void benchmarkSolvers()
+{
+	const to_solver_mode_t solvers[4] = { TO_SOLVER_EXACT, TO_SOLVER_FAST, TO_SOLVER_TABLE, TO_SOLVER_LUT };
+	const char* solverNames[4] = { "exact", "fast", "table", "lut" };
+	double micros[4] = { 0, 0, 0, 0 };
+	sensor.setMlxMode(MLX90640_CHESS);
+	for (int n = 0; n < BENCH_SUBPAGES; n++)
+	{
+		const float tr = (float)readSubPage(n).ta - OPENAIR_TA_SHIFT;
+		for (uint8_t s = 0; s < 4; s++)
+		{
+			sensor.setToSolverMode(solvers[s]);
+			micros[s] += bestMicros([&] { sensor.calculateTempMap(BENCH_EMISSIVITY, tr); });
+		}
+		sensor.setToSolverMode(TO_SOLVER_EXACT);
+	}
+	for (uint8_t s = 0; s < 4; s++)
+	{
+		micros[s] /= BENCH_SUBPAGES;
+		printf("%s solver: calculateTempMap %.1f us per subpage, %.2fx exact\n", solverNames[s], micros[s], micros[0] / micros[s]);
+	}
+	CHECK_BELOW(micros[3], micros[0]);
+}
+
+/* readImage end to end, the mock serves each subpage again for every run */
+static void benchmarkReadImage()
+{
+	sensor.setMlxMode(MLX90640_CHESS);
+	double micros = 0;
+	for (int n = 0; n < BENCH_SUBPAGES; n++)
+	{
+		mockFillFrame(n & 1, n);
+		micros += bestMicros([&] { mockPresentSubPage(n & 1); CHECK(sensor.readImage(BENCH_EMISSIVITY)); });
+	}
+	micros /= BENCH_SUBPAGES;
+	printf("readImage: %.1f us per subpage, limit %d us\n", micros, BENCH_READ_IMAGE_MAX_US);
+	CHECK_BELOW(micros, BENCH_READ_IMAGE_MAX_US);
+}
+
+/* Frame size -fstack-usage recorded for the function in suFile, -1 when it is not there */
+static long stackUsage(const char* suFile, const char* function)
+{
+	FILE* file = fopen(suFile, "r");
+	if (file == NULL)
+	{
+		return -1;
+	}
+	long bytes = -1;
+	char line[512];
+	while (bytes < 0 && fgets(line, sizeof(line), file) != NULL)
+	{
+		const char* size = strchr(line, '\t');
+		if (size != NULL && strstr(line, function) != NULL)
+		{
+			bytes = strtol(size + 1, NULL, 10);
+		}
+	}
+	fclose(file);
+	return bytes;
+}
+
+/* convertMlxEEToParams against the float parser it replaced, on randomized EEPROM images. The
+   bit-identical output is checked by test_calibration, this only measures time and stack. */
+static void benchmarkParsers()
+{
+	static paramsMLX90640_t params;
+	double parseMicros = 0;
+	double referenceMicros = 0;
+	for (uint32_t seed = 1; seed <= BENCH_EE_IMAGES; seed++)
+	{
+		mockGenerateRandomEE(seed);
+		sensor.readMlxEE();
+		parseMicros += bestMicros([&] { sensor.convertMlxEEToParams(); });
+		referenceMicros += bestMicros([&] { referenceConvertEE(mockEE(), params); });
+	}
+	parseMicros /= BENCH_EE_IMAGES;
+	referenceMicros /= BENCH_EE_IMAGES;
+	const long parseStack = stackUsage(BENCH_BUILD "/thermal.su", "IRSensor::convertMlxEEToParams(");
+	const long referenceStack = stackUsage(BENCH_BUILD "/reference_mlx90640.su", "referenceConvertEE(");
+	printf("float parser %.1f us and %ld stack bytes, convertMlxEEToParams %.1f us and %ld stack bytes\n",
+		referenceMicros, referenceStack, parseMicros, parseStack);
+	CHECK(parseStack > 0 && referenceStack > 0);
+	CHECK_BELOW(parseStack, referenceStack);
+	CHECK_BELOW(parseMicros, referenceMicros);
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	referenceConvertEE(mockEE(), reference);
+
+	/* exact offsets, the old loop has no cache */
+	sensor.setOffsetCacheEpsilon(0, 0);
+	benchmarkTempMap();
+	benchmarkDispatch();
+	benchmarkSolvers();
+	benchmarkReadImage();
+	benchmarkParsers();
+	return testResult("test_benchmark");
+}
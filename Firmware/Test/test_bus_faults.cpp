@@ -0,0 +1,166 @@
+/* Injects I2C faults into the bus owner's transfers and checks the retries, the telemetry, that a
+   recovered read gives the same maps as a fault-free run, and that the sensor configuration lost with
+   each fault is restored. Single-threaded: the bus runs in the caller. */
+#include "test.h"
+#include "mock_sensor.h"
+#include <thermal.h>
+#include <string.h>
+
+#define FAULT_SUBPAGES 40
+#define FAULT_EMISSIVITY 0.95f
+#define FAULT_READ_ATTEMPTS 4
+
+#define FAULT_SCENARIOS 6
+
+static uint16_t frames[FAULT_SUBPAGES][832];
+static float cleanMaps[FAULT_SUBPAGES][768];
+/* statics like irSensor in main.cpp: the half of the map not read yet starts zeroed in every run */
+static I2CBus buses[FAULT_SCENARIOS];
+static IRSensor sensors[FAULT_SCENARIOS];
+static int scenario = 0;
+
+static void present(const int n)
+{
+	memcpy(mockFrameRam(), frames[n], sizeof(frames[n]));
+	mockPresentSubPage(n & 1);
+}
+
+/* Reads every subpage, polling again after a failed read like the IR task does */
+static int replay(IRSensor* sensor, I2CBus* bus, float (*maps)[768], int* mismatches)
+{
+	int failedReads = 0;
+	*mismatches = 0;
+	mockAttachBus(bus);
+	for (int n = 0; n < FAULT_SUBPAGES; n++)
+	{
+		present(n);
+		bool ok = false;
+		for (int attempt = 0; attempt < FAULT_READ_ATTEMPTS && !ok; attempt++)
+		{
+			ok = sensor->readImage(FAULT_EMISSIVITY);
+			failedReads += ok ? 0 : 1;
+		}
+		CHECK(ok);
+		if (maps != NULL)
+		{
+			memcpy(maps[n], sensor->getTempMap(), sizeof(maps[n]));
+		}
+		else if (memcmp(sensor->getTempMap(), cleanMaps[n], sizeof(cleanMaps[n])) != 0)
+		{
+			(*mismatches)++;
+		}
+	}
+	return failedReads;
+}
+
+/* One fault plan against a fresh sensor and bus, the sensor resets with the fault and must get its
+   control register back. Returns the bus telemetry. */
+static i2c_bus_telemetry_t runFaults(const char* name, const mock_faults_t& plan, int* failedReads, uint32_t* dropped)
+{
+	I2CBus* bus = &buses[scenario];
+	IRSensor* sensor = &sensors[scenario++];
+	bus->init();
+	mockAttachBus(bus);
+	CHECK(sensor->init(bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	const uint16_t control = mockControl();
+	CHECK(control != MOCK_CONTROL_POWER_ON);
+	mockResetFaults();
+	*mockFaults() = plan;
+	mockFaults()->resetOnFault = true;
+
+	int mismatches = 0;
+	*failedReads = replay(sensor, bus, NULL, &mismatches);
+	*dropped = sensor->getDroppedFrames();
+	const i2c_bus_telemetry_t telemetry = bus->getTelemetry();
+	printf("%s: faults %u retries %u clears %u stuck %u recovered %u failed %u, max recovery %u ms, %d failed reads, %d maps differ, %u restores\n",
+		name, telemetry.faults, telemetry.retries, telemetry.busClears, telemetry.stuckBus, telemetry.recovered, telemetry.failed,
+		telemetry.maxRecoveryMs, *failedReads, mismatches, sensor->getControlRestores());
+	CHECK(mismatches == 0);
+	CHECK(sensor->getControlRestores() == 1);
+	CHECK(mockControl() == control);
+	return telemetry;
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	for (int n = 0; n < FAULT_SUBPAGES; n++)
+	{
+		mockFillFrame(n & 1, n);
+		memcpy(frames[n], mockFrameRam(), sizeof(frames[n]));
+	}
+
+	/* fault-free maps to compare with */
+	{
+		I2CBus* bus = &buses[scenario];
+		IRSensor* sensor = &sensors[scenario++];
+		bus->init();
+		mockAttachBus(bus);
+		mockResetFaults();
+		CHECK(sensor->init(bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+		int mismatches = 0;
+		CHECK(replay(sensor, bus, cleanMaps, &mismatches) == 0);
+		CHECK(bus->getTelemetry().faults == 0);
+	}
+
+	int failedReads = 0;
+	uint32_t dropped = 0;
+	mock_faults_t plan;
+
+	/* one stalled burst, recovered by the first retry */
+	memset(&plan, 0, sizeof(plan));
+	plan.dmaFailAt = 30;
+	plan.dmaFailRun = 1;
+	i2c_bus_telemetry_t telemetry = runFaults("1 stall", plan, &failedReads, &dropped);
+	CHECK(telemetry.faults == 1 && telemetry.recovered == 1 && telemetry.failed == 0 && telemetry.retries == 1);
+	CHECK(telemetry.maxRecoveryMs >= I2C_BUS_DMA_TIMEOUT_MS);
+	CHECK(failedReads == 0 && dropped == 0);
+
+	/* three stalls in a row with SDA held low through the first clear, the last retry gets through */
+	memset(&plan, 0, sizeof(plan));
+	plan.dmaFailAt = 30;
+	plan.dmaFailRun = 3;
+	plan.stuckClears = 1;
+	telemetry = runFaults("3 stalls, stuck bus", plan, &failedReads, &dropped);
+	CHECK(telemetry.faults == 1 && telemetry.recovered == 1 && telemetry.failed == 0 && telemetry.retries == 3);
+	CHECK(telemetry.busClears == 3 && telemetry.stuckBus == 1);
+	CHECK(failedReads == 0 && dropped == 0);
+
+	/* a failed blocking word read */
+	memset(&plan, 0, sizeof(plan));
+	plan.readFailAt = 12;
+	telemetry = runFaults("failed word read", plan, &failedReads, &dropped);
+	CHECK(telemetry.faults == 1 && telemetry.recovered == 1 && telemetry.failed == 0);
+	CHECK(dropped == 0);
+
+	/* a failed status clear, the subpage was read and stays valid */
+	memset(&plan, 0, sizeof(plan));
+	plan.wordWriteFailAt = 10;
+	telemetry = runFaults("failed status write", plan, &failedReads, &dropped);
+	CHECK(telemetry.faults == 1 && telemetry.recovered == 1 && telemetry.failed == 0);
+	CHECK(failedReads == 0 && dropped == 0);
+
+	/* four stalls exhaust the retries: the subpage is dropped and read again on the next poll */
+	memset(&plan, 0, sizeof(plan));
+	plan.dmaFailAt = 30;
+	plan.dmaFailRun = I2C_BUS_RETRIES + 1;
+	telemetry = runFaults("4 stalls", plan, &failedReads, &dropped);
+	CHECK(telemetry.faults == 1 && telemetry.recovered == 0 && telemetry.failed == 1);
+	/* plus the tick the recovery time itself polls while the last DMA is still stalled */
+	CHECK(telemetry.maxRecoveryMs <= I2C_BUS_DMA_WORST_MS + 1);
+	CHECK(failedReads == 1 && dropped == 1);
+
+	/* a failed 8-bit register write is retried like any other transfer */
+	{
+		I2CBus bus;
+		bus.init();
+		mockResetFaults();
+		mockFaults()->writeFailAt = 1;
+		uint8_t value = 0x5A;
+		CHECK(bus.transfer(I2C_BUS_WRITE, 0x82, 0x10, &value, 1, I2C_BUS_PRIORITY_LOW));
+		const i2c_bus_telemetry_t& writeTelemetry = bus.getTelemetry();
+		CHECK(writeTelemetry.faults == 1 && writeTelemetry.recovered == 1 && writeTelemetry.retries == 1);
+		CHECK(mockCounters()->byteWrites == 2);
+	}
+	return testResult("test_bus_faults");
+}
@@ -0,0 +1,88 @@
+/* Runs the bus owner, a low-priority bus client and the acquisition task on their own threads in
+   real time. One frame burst is stalled through every retry while the rest of the subpage is queued
+   behind it: the read must wait for all of its bursts before the raw buffer goes back to the pool. */
+#include "test.h"
+#include "mock_sensor.h"
+#include <thermal.h>
+#include <atomic>
+#include <thread>
+#include <string.h>
+#include <unistd.h>
+
+#define THREADS_EMISSIVITY 0.95f
+
+static I2CBus bus;
+static IRSensor sensor;
+static std::atomic<int> touchReads(0);
+
+/* Like the touch controller polling on the low queue */
+static void touchTask()
+{
+	for (;;)
+	{
+		uint8_t data[4];
+		if (bus.transfer(I2C_BUS_READ, 0x82, 0x4D, data, sizeof(data), I2C_BUS_PRIORITY_LOW))
+		{
+			touchReads++;
+		}
+		vTaskDelay(pdMS_TO_TICKS(5));
+	}
+}
+
+static bool acquire(const int n)
+{
+	mockFillFrame(n & 1, n);
+	mockSetReadWindow(true);
+	const bool ok = sensor.acquireFrame();
+	mockSetReadWindow(false);
+	return ok;
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+
+	/* the bus task is created first and blocks on its queue before any client submits */
+	mockStartScheduler();
+	std::thread(&I2CBus::run, &bus).detach();
+	vTaskDelay(pdMS_TO_TICKS(10));
+	std::thread(touchTask).detach();
+
+	CHECK(acquire(0));
+	CHECK(sensor.processFrame(THREADS_EMISSIVITY, 0));
+
+	/* the first burst stalls through every retry, the others wait for it in the high queue */
+	mockResetFaults();
+	mockFaults()->dmaFailAt = 1;
+	mockFaults()->dmaFailRun = I2C_BUS_RETRIES + 1;
+	const uint32_t start = HAL_GetTick();
+	CHECK(!acquire(1));
+	const uint32_t elapsed = HAL_GetTick() - start;
+
+	/* anything still in flight would land in the pool buffer now */
+	vTaskDelay(pdMS_TO_TICKS(2 * I2C_BUS_DMA_WORST_MS));
+	const mock_counters_t counters = *mockCounters();
+	const i2c_bus_telemetry_t telemetry = bus.getTelemetry();
+	printf("dropped read took %u ms, %d DMA transfers, %d late DMA writes, %u burst stalls, %d touch reads\n",
+		elapsed, counters.dmaTransfers, counters.lateDmaWrites, sensor.getBurstStalls(), touchReads.load());
+	CHECK(elapsed >= I2C_BUS_DMA_TIMEOUT_MS * (I2C_BUS_RETRIES + 1));
+	CHECK(counters.lateDmaWrites == 0);
+	CHECK(sensor.getBurstStalls() == 0);
+	CHECK(sensor.getDroppedFrames() == 1);
+	CHECK(telemetry.faults == 1 && telemetry.failed == 1);
+
+	/* the subpage is still announced, the next poll reads it */
+	mockSetReadWindow(true);
+	CHECK(sensor.acquireFrame());
+	mockSetReadWindow(false);
+	CHECK(sensor.processFrame(THREADS_EMISSIVITY, 0));
+	CHECK(touchReads.load() > 0);
+
+	/* the bus and touch tasks never return */
+	const int result = testResult("test_bus_threads");
+	fflush(stdout);
+	_exit(result);
+}
@@ -0,0 +1,107 @@
+/* Parses randomized EEPROM images with the firmware's integer extraction and with the float parser it
+   replaced; the resulting paramsMLX90640_t must match byte for byte. Then walks the flash cache through
+   warm, corrupt, foreign-serial and old-version boots. */
+#include "test.h"
+#include "mock_sensor.h"
+#include "reference_mlx90640.h"
+#include <thermal.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#define CALIBRATION_IMAGES 400
+
+static I2CBus bus;
+static IRSensor sensor;
+static paramsMLX90640_t reference;
+
+/* Cold boot: parse at init, then the deferred write puts the parsed calibration into flash */
+static const paramsMLX90640_t* parseCold(IRSensor& target)
+{
+	mockEraseFlash();
+	CHECK(target.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	CHECK(!target.isCalibrationCached());
+	CHECK(target.storePendingCalibration());
+	return &((const calib_cache_t*)mockFlash())->params;
+}
+
+static bool matchesReference(const paramsMLX90640_t* parsed)
+{
+	return memcmp(parsed, &reference, sizeof(reference)) == 0;
+}
+
+static bool boot()
+{
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	return sensor.isCalibrationCached();
+}
+
+static void checkCache()
+{
+	mockGenerateEE(12345);
+	mockEraseFlash();
+	mockResetFaults();
+	calib_cache_t* cache = (calib_cache_t*)mockFlash();
+
+	/* cold boot parses and defers the write, nothing is erased before the first frame */
+	CHECK(!boot());
+	CHECK(mockCounters()->flashErases == 0);
+	CHECK(sensor.storePendingCalibration());
+	CHECK(!sensor.storePendingCalibration());
+	CHECK(mockCounters()->flashErases == 1);
+	referenceConvertEE(mockEE(), reference);
+
+	/* warm boot loads the same calibration without touching flash */
+	CHECK(boot());
+	CHECK(!sensor.storePendingCalibration());
+	CHECK(memcmp(&cache->params, &reference, sizeof(reference)) == 0);
+	CHECK(mockCounters()->flashErases == 1);
+
+	/* one flipped bit fails the CRC, the next boot reparses and rewrites */
+	((uint8_t*)&cache->params)[300] ^= 0x04;
+	CHECK(!boot());
+	CHECK(sensor.storePendingCalibration());
+	CHECK(boot());
+
+	/* another sensor, or a cache from another parser version, is not used */
+	mockEE()[MOCK_SERIAL_WORD] ^= 1;
+	CHECK(!boot());
+	mockEE()[MOCK_SERIAL_WORD] ^= 1;
+	CHECK(boot());
+	const uint32_t version = CALIB_CACHE_VERSION - 1;
+	HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uint32_t)(uintptr_t)&cache->header.version, version);
+	CHECK(!boot());
+	CHECK(sensor.storePendingCalibration());
+	CHECK(cache->header.version == CALIB_CACHE_VERSION);
+	CHECK(boot());
+	CHECK(mockCounters()->flashErases == 3);
+}
+
+int main()
+{
+	bus.init();
+	mockAttachBus(&bus);
+
+	/* every image twice by a zeroed sensor like irSensor at first boot, then once by a sensor whose last
+	   parse was another image: nothing of an earlier parse may leak into the next one */
+	int mismatches = 0;
+	for (int image = 0; image < CALIBRATION_IMAGES; image++)
+	{
+		mockGenerateRandomEE(1000 + image);
+		referenceConvertEE(mockEE(), reference);
+		void* memory = calloc(1, sizeof(IRSensor));
+		IRSensor* cold = new (memory) IRSensor();
+		for (uint8_t parse = 0; parse < 2; parse++)
+		{
+			mismatches += matchesReference(parseCold(*cold)) ? 0 : 1;
+		}
+		cold->~IRSensor();
+		free(memory);
+		mismatches += matchesReference(parseCold(sensor)) ? 0 : 1;
+	}
+	printf("%d images parsed three times, %d parses differ from the float parser\n", CALIBRATION_IMAGES, mismatches);
+	CHECK(mismatches == 0);
+
+	checkCache();
+	return testResult("test_calibration");
+}
@@ -0,0 +1,106 @@
+/* Replays subpages with a slowly drifting supply and ambient through a sensor at the shipped offset
+   cache tolerances, compares every updated pixel with the double-precision Melexis solve, then steps
+   Vdd and Ta past their epsilons and checks that each step rebuilds the cached offsets. */
+#include "test.h"
+#include "mock_sensor.h"
+#include "reference_mlx90640.h"
+#include <thermal.h>
+#include <math.h>
+
+#define DRIFT_SUBPAGES 240
+#define DRIFT_EMISSIVITY 0.95f
+#define DRIFT_PTAT_STEP 40      ///< subpages per PTAT count, about 0.09 K
+#define DRIFT_VDD_STEP 2        ///< subpages per Vdd count, about 0.3 mV
+#define DRIFT_MAX_ERROR_K 0.003 ///< offsets up to one epsilon of Ta and Vdd old, 0.0014 K measured
+
+static I2CBus bus;
+static IRSensor sensor;
+static paramsMLX90640_t reference;
+
+static bool isBadPixel(const uint16_t pixel)
+{
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		if (reference.brokenPixels[i] == pixel || reference.outlierPixels[i] == pixel)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Fills subpage n with the given PTAT and Vdd words, reads it and returns the largest To error of
+   the pixels it updated */
+static double readDrifted(const int n, const uint16_t ptat, const int16_t vdd, reference_ambient_t& ambient)
+{
+	mockFillFrame(n & 1, n);
+	mockFrameRam()[800] = ptat;
+	mockFrameRam()[810] = (uint16_t)vdd;
+	CHECK(sensor.readImage(DRIFT_EMISSIVITY));
+
+	double to[768];
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		to[i] = NAN;
+	}
+	ambient = referenceCalculateTo(reference, mockFrameRam(), mockControl(), n & 1, DRIFT_EMISSIVITY, to);
+	double worst = 0;
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		if (!isBadPixel(i) && !isnan(to[i]))
+		{
+			worst = fmax(worst, fabs(sensor.getTempMap()[i] - to[i]));
+		}
+	}
+	return worst;
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	referenceConvertEE(mockEE(), reference);
+
+	/* Ta rises a tenth of a kelvin every few seconds, Vdd sags a third of a millivolt every other subpage */
+	double worst = 0;
+	reference_ambient_t first;
+	reference_ambient_t ambient;
+	for (int n = 0; n < DRIFT_SUBPAGES; n++)
+	{
+		const uint16_t ptat = 1711 + n / DRIFT_PTAT_STEP;
+		const int16_t vdd = -13115 + n / DRIFT_VDD_STEP;
+		worst = fmax(worst, readDrifted(n, ptat, vdd, n == 0 ? first : ambient));
+	}
+	const uint32_t hits = sensor.getOffsetCacheHits();
+	const uint32_t rebuilds = sensor.getOffsetCacheRebuilds();
+	printf("drift of %.3f K and %.2f mV over %d subpages: %u rebuilds, %u hits, max error %.2e K vs double reference\n",
+		ambient.ta - first.ta, (ambient.vdd - first.vdd) * 1000, DRIFT_SUBPAGES, rebuilds, hits, worst);
+	CHECK_BELOW(worst, DRIFT_MAX_ERROR_K);
+	CHECK(hits > 0);
+	CHECK(hits + rebuilds == DRIFT_SUBPAGES);
+	CHECK(rebuilds < DRIFT_SUBPAGES / 2);
+
+	/* same words again: within both epsilons, the cache is used */
+	const uint16_t ptat = 1711 + (DRIFT_SUBPAGES - 1) / DRIFT_PTAT_STEP;
+	const int16_t vdd = -13115 + (DRIFT_SUBPAGES - 1) / DRIFT_VDD_STEP;
+	reference_ambient_t before;
+	reference_ambient_t after;
+	readDrifted(DRIFT_SUBPAGES, ptat, vdd, before);
+	CHECK(sensor.getOffsetCacheRebuilds() == rebuilds);
+	CHECK(sensor.getOffsetCacheHits() == hits + 1);
+
+	/* a Vdd step past OFFSET_CACHE_VDD_EPS at the same PTAT */
+	CHECK_BELOW(readDrifted(DRIFT_SUBPAGES + 1, ptat, vdd + 10, after), DRIFT_MAX_ERROR_K);
+	CHECK(fabs(after.vdd - before.vdd) > OFFSET_CACHE_VDD_EPS);
+	CHECK(sensor.getOffsetCacheRebuilds() == rebuilds + 1);
+
+	/* a Ta step past OFFSET_CACHE_TA_EPS at the same Vdd */
+	before = after;
+	CHECK_BELOW(readDrifted(DRIFT_SUBPAGES + 2, ptat + 2, vdd + 10, after), DRIFT_MAX_ERROR_K);
+	CHECK(fabs(after.ta - before.ta) > OFFSET_CACHE_TA_EPS);
+	CHECK(fabs(after.vdd - before.vdd) < OFFSET_CACHE_VDD_EPS);
+	CHECK(sensor.getOffsetCacheRebuilds() == rebuilds + 2);
+	return testResult("test_offset_cache");
+}
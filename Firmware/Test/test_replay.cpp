@@ -0,0 +1,136 @@
+/* Replays synthetic subpages through the radiometric pipeline and compares every updated pixel with
+   the double-precision Melexis solve, in chess and interleaved readout, sequential and pipelined. */
+#include "test.h"
+#include "mock_sensor.h"
+#include "reference_mlx90640.h"
+#include <thermal.h>
+#include <math.h>
+#include <string.h>
+
+#define REPLAY_SUBPAGES 200
+#define REPLAY_EMISSIVITY 0.95f
+#define REPLAY_MAX_ERROR_K 0.0005 ///< float pipeline against the double reference
+
+static I2CBus bus;
+static IRSensor sensor;
+static IRSensor pipelined;
+static paramsMLX90640_t reference;
+static uint16_t frames[REPLAY_SUBPAGES][832];
+static float sequentialMaps[REPLAY_SUBPAGES][768];
+
+static bool isBadPixel(const uint16_t pixel)
+{
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		if (reference.brokenPixels[i] == pixel || reference.outlierPixels[i] == pixel)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Largest To error of the pixels this subpage updated, the other half keeps the previous map
+   except for patched bad pixels */
+static double compareWithReference(const float* map, const float* previous, const uint8_t subPage)
+{
+	double to[768];
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		to[i] = NAN;
+	}
+	referenceCalculateTo(reference, mockFrameRam(), mockControl(), subPage, REPLAY_EMISSIVITY, to);
+	double worst = 0;
+	uint16_t compared = 0;
+	uint16_t overwritten = 0;
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		if (isBadPixel(i))
+		{
+			continue;
+		}
+		if (isnan(to[i]))
+		{
+			overwritten += (map[i] != previous[i]) ? 1 : 0;
+			continue;
+		}
+		compared++;
+		worst = fmax(worst, fabs(map[i] - to[i]));
+	}
+	CHECK(compared >= 768 / 2 - 3);
+	CHECK(overwritten == 0);
+	return worst;
+}
+
+static double replay(const mlx90640_mode_t mode)
+{
+	sensor.setMlxMode(mode);
+	double worst = 0;
+	static float previous[768];
+	for (int n = 0; n < REPLAY_SUBPAGES; n++)
+	{
+		const uint8_t subPage = n & 1;
+		memcpy(previous, sensor.getTempMap(), sizeof(previous));
+		mockFillFrame(subPage, n);
+		memcpy(frames[n], mockFrameRam(), sizeof(frames[n]));
+		CHECK(sensor.readImage(REPLAY_EMISSIVITY));
+		memcpy(sequentialMaps[n], sensor.getTempMap(), sizeof(sequentialMaps[n]));
+		worst = fmax(worst, compareWithReference(sensor.getTempMap(), previous, subPage));
+	}
+	return worst;
+}
+
+static void acquire(const int n)
+{
+	memcpy(mockFrameRam(), frames[n], sizeof(frames[n]));
+	mockPresentSubPage(n & 1);
+	CHECK(pipelined.acquireFrame());
+}
+
+/* Acquisition two subpages ahead of compute, like IrAcquire_Thread and IrSensor_Thread */
+static int replayPipelined(const mlx90640_mode_t mode)
+{
+	pipelined.setMlxMode(mode);
+	int mismatches = 0;
+	acquire(0);
+	acquire(1);
+	for (int n = 0; n < REPLAY_SUBPAGES; n++)
+	{
+		if (n + 2 < REPLAY_SUBPAGES)
+		{
+			acquire(n + 2);
+		}
+		CHECK(pipelined.processFrame(REPLAY_EMISSIVITY, 0));
+		if (memcmp(pipelined.getTempMap(), sequentialMaps[n], sizeof(sequentialMaps[n])) != 0)
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	CHECK(pipelined.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+	referenceConvertEE(mockEE(), reference);
+
+	/* exact offsets every subpage, the cache tolerance is not what is measured here */
+	sensor.setOffsetCacheEpsilon(0, 0);
+	pipelined.setOffsetCacheEpsilon(0, 0);
+
+	const mlx90640_mode_t modes[2] = { MLX90640_CHESS, MLX90640_INTERLEAVED };
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		const double worst = replay(modes[i]);
+		const int mismatches = replayPipelined(modes[i]);
+		printf("%s: max error %.2e K vs double reference, %d pipelined maps differ\n",
+			modes[i] == MLX90640_CHESS ? "chess" : "interleaved", worst, mismatches);
+		CHECK_BELOW(worst, REPLAY_MAX_ERROR_K);
+		CHECK(mismatches == 0);
+	}
+	return testResult("test_replay");
+}
@@ -0,0 +1,142 @@
+/* Sweeps pixel signals over the whole -40..300 C range through every To solver and compares each
+   with the double-precision Melexis solve against the bounds documented on to_solver_mode_t */
+#include "test.h"
+#include "mock_sensor.h"
+#include "reference_mlx90640.h"
+#include <thermal.h>
+#include <math.h>
+#include <string.h>
+
+#define SWEEP_PASSES 40
+#define SWEEP_EMISSIVITY 0.95f
+#define SWEEP_TO_MIN -40.0
+#define SWEEP_TO_MAX 300.0
+
+static I2CBus bus;
+static IRSensor sensors[4];
+static paramsMLX90640_t reference;
+static const to_solver_mode_t solvers[4] = { TO_SOLVER_EXACT, TO_SOLVER_FAST, TO_SOLVER_TABLE, TO_SOLVER_LUT };
+static const char* solverNames[4] = { "exact", "fast", "table", "lut" };
+static const double solverBounds[4] = { 0.0001, 0.025, 0.005, 0.01 };
+
+static bool isBadPixel(const uint16_t pixel)
+{
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		if (reference.brokenPixels[i] == pixel || reference.outlierPixels[i] == pixel)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Every pixel a different signal, spread from below -40 C to above 300 C */
+static void fillSweep(const int pass, const int16_t ptat)
+{
+	mockLock();
+	uint16_t* frame = mockFrameRam();
+	for (uint16_t k = 0; k < 768; k++)
+	{
+		frame[k] = (uint16_t)(int16_t)(-1300 + ((k * 37 + pass * 911) % 768) * 17 + pass);
+	}
+	frame[768] = 19200;
+	frame[800] = ptat;
+	frame[810] = (uint16_t)(int16_t)-13115;
+	frame[778] = 6383;
+	frame[776] = (uint16_t)(int16_t)-60;
+	frame[808] = (uint16_t)(int16_t)-58;
+	mockUnlock();
+}
+
+/* Reads the subpage in frame RAM into every sensor and tracks the largest error of each */
+static void readIntoAll(IRSensor* targets, const uint8_t count, const uint8_t subPage, double* worst, uint32_t* compared)
+{
+	double to[768];
+	for (uint16_t i = 0; i < 768; i++)
+	{
+		to[i] = NAN;
+	}
+	referenceCalculateTo(reference, mockFrameRam(), mockControl(), subPage, SWEEP_EMISSIVITY, to);
+	for (uint8_t s = 0; s < count; s++)
+	{
+		mockPresentSubPage(subPage);
+		CHECK(targets[s].readImage(SWEEP_EMISSIVITY));
+		const float* map = targets[s].getTempMap();
+		for (uint16_t i = 0; i < 768; i++)
+		{
+			if (isnan(to[i]) || isBadPixel(i) || to[i] < SWEEP_TO_MIN || to[i] > SWEEP_TO_MAX)
+			{
+				continue;
+			}
+			compared[s]++;
+			worst[s] = fmax(worst[s], fabs(map[i] - to[i]));
+		}
+	}
+}
+
+/* PTAT moves Ta by about 0.1 K per count */
+static int16_t driftingPtat(const int pass)
+{
+	return 1711 + pass / 10;
+}
+
+static int16_t jumpingPtat(const int pass)
+{
+	return (pass & 1) ? 1691 : 1731;
+}
+
+static double sweepTa(int16_t (*ptat)(int))
+{
+	double worst = 0;
+	uint32_t compared = 0;
+	for (int pass = 0; pass < 200; pass++)
+	{
+		for (uint8_t subPage = 0; subPage < 2; subPage++)
+		{
+			fillSweep(pass, ptat(pass));
+			readIntoAll(&sensors[3], 1, subPage, &worst, &compared);
+		}
+	}
+	return worst;
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	for (uint8_t s = 0; s < 4; s++)
+	{
+		CHECK(sensors[s].init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+		sensors[s].setOffsetCacheEpsilon(0, 0);
+		sensors[s].setToSolverMode(solvers[s]);
+	}
+	referenceConvertEE(mockEE(), reference);
+
+	double worst[4] = { 0, 0, 0, 0 };
+	uint32_t compared[4] = { 0, 0, 0, 0 };
+	for (int pass = 0; pass < SWEEP_PASSES; pass++)
+	{
+		for (uint8_t subPage = 0; subPage < 2; subPage++)
+		{
+			fillSweep(pass, 1711);
+			readIntoAll(sensors, 4, subPage, worst, compared);
+		}
+	}
+	for (uint8_t s = 0; s < 4; s++)
+	{
+		printf("%s: %u pixels, max error %.2e K\n", solverNames[s], compared[s], worst[s]);
+		CHECK(compared[s] > SWEEP_PASSES * 700);
+		CHECK_BELOW(worst[s], solverBounds[s]);
+	}
+
+	/* the LUT follows a changing Ta with a shifted table while the next one is built */
+	const double drift = sweepTa(driftingPtat);
+	printf("lut, Ta drifting 0.01 K per subpage: max error %.2e K\n", drift);
+	CHECK_BELOW(drift, solverBounds[3]);
+	const double jumps = sweepTa(jumpingPtat);
+	printf("lut, Ta jumping 4 K every frame: max error %.2e K\n", jumps);
+	CHECK_BELOW(jumps, solverBounds[3]);
+	return testResult("test_solver");
+}
@@ -0,0 +1,58 @@
+/* Runs the mock sensor at 16 Hz and leaves 1, 2 and 3 subpages unread, after a complete frame and in
+   the middle of one, then checks the repeat, skip and resync counters and the frame sequence. */
+#include "test.h"
+#include "mock_sensor.h"
+#include <thermal.h>
+
+#define SUBPAGES_EMISSIVITY 0.95f
+
+static I2CBus bus;
+static IRSensor sensor;
+
+/* The sensor announces subpage k & 1 at k periods, only the ones marked 'r' are read */
+static void run(const char* schedule)
+{
+	const float period = sensor.getFramePeriod();
+	const TickType_t start = xTaskGetTickCount();
+	for (int k = 0; schedule[k] != '\0'; k++)
+	{
+		const TickType_t tick = start + (TickType_t)(k * period + 0.5f);
+		mockAdvanceTicks(tick - xTaskGetTickCount());
+		mockFillFrame(k & 1, k);
+		if (schedule[k] == 'r')
+		{
+			CHECK(sensor.readImage(SUBPAGES_EMISSIVITY));
+		}
+	}
+}
+
+int main()
+{
+	mockGenerateEE(12345);
+	bus.init();
+	mockAttachBus(&bus);
+	CHECK(sensor.init(&bus, NULL, 0, 0, 320, 240, DEFAULT_COLOR_SCHEME));
+
+	/* two frames, then one, two and three subpages lost, the last two while a pair is half read */
+	run("rrrr" "-rr" "--rr" "r---rr" "r-rr");
+	const ir_frame_info_t& info = sensor.getFrameInfo();
+	printf("%u frames, %u repeats, %u skips, %u resyncs\n", info.sequence, sensor.getSubPageRepeats(),
+		sensor.getSubPageSkips(), sensor.getResyncs());
+	CHECK(info.sequence == 6);
+	CHECK(sensor.getSubPageRepeats() == 3);
+	CHECK(sensor.getSubPageSkips() == 1 + 2 + 3 + 1);
+	CHECK(sensor.getResyncs() == 2);
+	CHECK(info.lastTick - info.firstTick < 2 * sensor.getFramePeriod());
+
+	/* the same subpage served again within a period is a repeat, nothing was lost */
+	const uint32_t skips = sensor.getSubPageSkips();
+	mockAdvanceTicks((uint32_t)sensor.getFramePeriod());
+	mockFillFrame(1, 21);
+	CHECK(sensor.readImage(SUBPAGES_EMISSIVITY));
+	mockAdvanceTicks(10);
+	mockFillFrame(1, 22);
+	CHECK(sensor.readImage(SUBPAGES_EMISSIVITY));
+	CHECK(sensor.getSubPageRepeats() == 4);
+	CHECK(sensor.getSubPageSkips() == skips);
+	return testResult("test_subpages");
+}
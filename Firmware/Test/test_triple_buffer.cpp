@@ -0,0 +1,102 @@
+/* Publishes thermal frames from one thread and reads them from another as fast as both can go. Every
+   field is derived from the sequence number, so a frame the consumer sees half old and half new, or a
+   sequence going backwards, shows up as a mismatch. Both sides yield halfway through their buffer, so
+   the other one runs while a frame is half written or half checked even on a single core. */
+#include "test.h"
+#include <thermal.h>
+#include <atomic>
+#include <thread>
+
+#define STRESS_FRAMES 200000
+
+static TripleBuffer<thermal_frame_t> frames;
+static std::atomic<bool> producerDone(false);
+
+static float fieldValue(const uint32_t sequence, const uint16_t field)
+{
+	return (float)((sequence * 7u + field) & 0xFFFF);
+}
+
+static void producer()
+{
+	for (uint32_t sequence = 1; sequence <= STRESS_FRAMES; sequence++)
+	{
+		thermal_frame_t* frame = frames.writeBuffer();
+		frame->info.sequence = sequence;
+		for (uint16_t i = 0; i < 24*32; i++)
+		{
+			frame->map[i] = fieldValue(sequence, i);
+			if (i == 24*16)
+			{
+				std::this_thread::yield();
+			}
+		}
+		frame->minTemp = fieldValue(sequence, 1000);
+		frame->maxTemp = fieldValue(sequence, 1001);
+		frame->hotDotIndex = (uint16_t)(sequence % 768);
+		frame->info.lastTick = sequence;
+		frames.publish();
+	}
+	producerDone = true;
+}
+
+/* Consumer: every frame read must be whole, sequence 0 is the zeroed buffer before the first one */
+static bool isConsistent(const thermal_frame_t* frame)
+{
+	const uint32_t sequence = frame->info.sequence;
+	if (sequence == 0)
+	{
+		return true;
+	}
+	if (frame->minTemp != fieldValue(sequence, 1000) || frame->maxTemp != fieldValue(sequence, 1001) ||
+		frame->hotDotIndex != sequence % 768 || frame->info.lastTick != sequence)
+	{
+		return false;
+	}
+	for (uint16_t i = 0; i < 24*32; i++)
+	{
+		if (frame->map[i] != fieldValue(sequence, i))
+		{
+			return false;
+		}
+		if (i == 24*16)
+		{
+			std::this_thread::yield();
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	std::thread producerThread(producer);
+	uint32_t reads = 0;
+	uint32_t distinct = 0;
+	uint32_t torn = 0;
+	uint32_t backwards = 0;
+	uint32_t last = 0;
+	bool done = false;
+	while (!done)
+	{
+		/* one more pass after the producer stops, to see its last publication */
+		done = producerDone;
+		const thermal_frame_t* frame = frames.latest();
+		reads++;
+		torn += isConsistent(frame) ? 0 : 1;
+		if (frame->info.sequence < last)
+		{
+			backwards++;
+		}
+		distinct += (frame->info.sequence != last) ? 1 : 0;
+		last = frame->info.sequence;
+	}
+	producerThread.join();
+
+	printf("%u frames published, %u reads, %u distinct frames seen, %u torn, %u backwards\n",
+		STRESS_FRAMES, reads, distinct, torn, backwards);
+	CHECK(torn == 0);
+	CHECK(backwards == 0);
+	CHECK(last == STRESS_FRAMES);
+	CHECK(distinct > 1);
+	return testResult("test_triple_buffer");
+}